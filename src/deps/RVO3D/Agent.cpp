@@ -44,22 +44,6 @@ namespace RVO {
 	 */
 	const float RVO_EPSILON = 0.00001f;
 
-	/**
-	 * \brief   Defines a directed line.
-	 */
-	class Line {
-	public:
-		/**
-		 * \brief   The direction of the directed line.
-		 */
-		Vector3 direction;
-
-		/**
-		 * \brief   A point on the directed line.
-		 */
-		Vector3 point;
-	};
-
 	/**
 	 * \brief   Solves a one-dimensional linear program on a specified line subject to linear constraints defined by planes and a spherical constraint.
 	 * \param   planes        Planes defining the linear constraints.
@@ -101,98 +85,476 @@ namespace RVO {
 	 * \param   planes     Planes defining the linear constraints.
 	 * \param   beginPlane The plane on which the 3-d linear program failed.
 	 * \param   radius     The radius of the spherical constraint.
+	 * \param   projPlanes Buffer for the projected planes.
 	 * \param   result     A reference to the result of the linear program.
 	 */
-	void linearProgram4(const std::vector<Plane> &planes, size_t beginPlane, float radius, Vector3 &result);
+	void linearProgram4(const std::vector<Plane> &planes, size_t beginPlane, float radius, std::vector<Plane> &projPlanes, Vector3 &result);
 
-	Agent::Agent(RVOSimulator *sim) : sim_(sim), id_(0), maxNeighbors_(0), maxSpeed_(0.0f), neighborDist_(0.0f), radius_(0.0f), timeHorizon_(0.0f) { }
-
-	void Agent::computeNeighbors()
+#if RVO_PLANAR
+	/**
+	 * \brief   Computes the determinant of the xy parts of two vectors.
+	 * \param   vector1  The top row of the matrix.
+	 * \param   vector2  The bottom row of the matrix.
+	 * \return  The determinant of the two-dimensional square matrix.
+	 */
+	inline float det(const Vector3 &vector1, const Vector3 &vector2)
 	{
-		agentNeighbors_.clear();
-
-		if (maxNeighbors_ > 0) {
-			sim_->kdTree_->computeAgentNeighbors(this, neighborDist_ * neighborDist_);
-		}
+		return vector1.x() * vector2.y() - vector1.y() * vector2.x();
 	}
 
-	void Agent::computeNewVelocity()
+	/**
+	 * \brief   Solves a one-dimensional linear program on a specified line subject to linear constraints defined by lines in the xy plane and a circular constraint.
+	 * \param   lines         Lines defining the linear constraints.
+	 * \param   lineNo        The specified line constraint.
+	 * \param   radius        The radius of the circular constraint.
+	 * \param   optVelocity   The optimization velocity.
+	 * \param   directionOpt  True if the direction should be optimized.
+	 * \param   result        A reference to the result of the linear program.
+	 * \return  True if successful.
+	 */
+	bool planarProgram1(const std::vector<Line> &lines, size_t lineNo, float radius, const Vector3 &optVelocity, bool directionOpt, Vector3 &result);
+
+	/**
+	 * \brief   Solves a two-dimensional linear program subject to linear constraints defined by lines in the xy plane and a circular constraint.
+	 * \param   lines         Lines defining the linear constraints.
+	 * \param   radius        The radius of the circular constraint.
+	 * \param   optVelocity   The optimization velocity.
+	 * \param   directionOpt  True if the direction should be optimized.
+	 * \param   result        A reference to the result of the linear program.
+	 * \return  The number of the line it fails on, and the number of lines if successful.
+	 */
+	size_t planarProgram2(const std::vector<Line> &lines, float radius, const Vector3 &optVelocity, bool directionOpt, Vector3 &result);
+
+	/**
+	 * \brief   Solves a three-dimensional linear program subject to linear constraints defined by lines in the xy plane and a circular constraint.
+	 * \param   lines      Lines defining the linear constraints.
+	 * \param   beginLine  The line on which the 2-d linear program failed.
+	 * \param   radius     The radius of the circular constraint.
+	 * \param   projLines  Buffer for the projected lines.
+	 * \param   result     A reference to the result of the linear program.
+	 */
+	void planarProgram3(const std::vector<Line> &lines, size_t beginLine, float radius, std::vector<Line> &projLines, Vector3 &result);
+
+	/**
+	 * \brief   Computes the ORCA line in the xy plane that keeps an agent from colliding with another object within a time horizon.
+	 * \param   relativePosition  The position of the other object relative to the agent, with no z.
+	 * \param   relativeVelocity  The velocity of the agent relative to the other object, with no z.
+	 * \param   combinedRadius    The sum of the radii of the agent and the object.
+	 * \param   invTimeHorizon    The inverse of the time horizon.
+	 * \param   invTimeStep       The inverse of the time step, for when they already overlap.
+	 * \param   line              Receives the direction of the line.
+	 * \return  The smallest change of the relative velocity that avoids the collision.
+	 */
+	static Vector3 computePlanarORCAChange(const Vector3 &relativePosition, const Vector3 &relativeVelocity, float combinedRadius, float invTimeHorizon, float invTimeStep, Line &line)
 	{
-		orcaPlanes_.clear();
-		const float invTimeHorizon = 1.0f / timeHorizon_;
+		const float distSq = absSq(relativePosition);
+		const float combinedRadiusSq = sqr(combinedRadius);
 
-		/* Create agent ORCA planes. */
-		for (size_t i = 0; i < agentNeighbors_.size(); ++i) {
-			const Agent *const other = agentNeighbors_[i].second;
-			const Vector3 relativePosition = other->position_ - position_;
-			const Vector3 relativeVelocity = velocity_ - other->velocity_;
-			const float distSq = absSq(relativePosition);
-			const float combinedRadius = radius_ + other->radius_;
-			const float combinedRadiusSq = sqr(combinedRadius);
+		Vector3 u;
 
-			Plane plane;
-			Vector3 u;
+		if (distSq > combinedRadiusSq) {
+			/* No collision. */
+			const Vector3 w = relativeVelocity - invTimeHorizon * relativePosition;
+			/* Vector from cutoff center to relative velocity. */
+			const float wLengthSq = absSq(w);
 
-			if (distSq > combinedRadiusSq) {
-				/* No collision. */
-				const Vector3 w = relativeVelocity - invTimeHorizon * relativePosition;
-				/* Vector from cutoff center to relative velocity. */
-				const float wLengthSq = absSq(w);
+			const float dotProduct = w * relativePosition;
 
-				const float dotProduct = w * relativePosition;
+			if (dotProduct < 0.0f && sqr(dotProduct) > combinedRadiusSq * wLengthSq) {
+				/* Project on cut-off circle. */
+				const float wLength = std::sqrt(wLengthSq);
+				const Vector3 unitW = w / wLength;
 
-				if (dotProduct < 0.0f && sqr(dotProduct) > combinedRadiusSq * wLengthSq) {
-					/* Project on cut-off circle. */
-					const float wLength = std::sqrt(wLengthSq);
-					const Vector3 unitW = w / wLength;
+				line.direction = Vector3(unitW.y(), -unitW.x(), 0.0f);
+				u = (combinedRadius * invTimeHorizon - wLength) * unitW;
+			}
+			else {
+				/* Project on legs. */
+				const float leg = std::sqrt(distSq - combinedRadiusSq);
 
-					plane.normal = unitW;
-					u = (combinedRadius * invTimeHorizon - wLength) * unitW;
+				if (det(relativePosition, w) > 0.0f) {
+					/* Project on left leg. */
+					line.direction = Vector3(relativePosition.x() * leg - relativePosition.y() * combinedRadius, relativePosition.x() * combinedRadius + relativePosition.y() * leg, 0.0f) / distSq;
 				}
 				else {
-					/* Project on cone. */
-					const float a = distSq;
-					const float b = relativePosition * relativeVelocity;
-					const float c = absSq(relativeVelocity) - absSq(cross(relativePosition, relativeVelocity)) / (distSq - combinedRadiusSq);
-					const float t = (b + std::sqrt(sqr(b) - a * c)) / a;
-					const Vector3 w = relativeVelocity - t * relativePosition;
-					const float wLength = abs(w);
-					const Vector3 unitW = w / wLength;
-
-					plane.normal = unitW;
-					u = (combinedRadius * t - wLength) * unitW;
+					/* Project on right leg. */
+					line.direction = -Vector3(relativePosition.x() * leg + relativePosition.y() * combinedRadius, -relativePosition.x() * combinedRadius + relativePosition.y() * leg, 0.0f) / distSq;
 				}
+
+				u = (relativeVelocity * line.direction) * line.direction - relativeVelocity;
+			}
+		}
+		else {
+			/* Collision. */
+			const Vector3 w = relativeVelocity - invTimeStep * relativePosition;
+			const float wLength = abs(w);
+			const Vector3 unitW = w / wLength;
+
+			line.direction = Vector3(unitW.y(), -unitW.x(), 0.0f);
+			u = (combinedRadius * invTimeStep - wLength) * unitW;
+		}
+
+		return u;
+	}
+#endif
+
+	/**
+	 * \brief   Computes the ORCA plane that keeps an agent from colliding with another object within a time horizon.
+	 * \param   relativePosition  The position of the other object relative to the agent.
+	 * \param   relativeVelocity  The velocity of the agent relative to the other object.
+	 * \param   combinedRadius    The sum of the radii of the agent and the object.
+	 * \param   invTimeHorizon    The inverse of the time horizon.
+	 * \param   invTimeStep       The inverse of the time step, for when they already overlap.
+	 * \param   plane             Receives the normal of the plane.
+	 * \return  The smallest change of the relative velocity that avoids the collision.
+	 */
+	static Vector3 computeORCAChange(const Vector3 &relativePosition, const Vector3 &relativeVelocity, float combinedRadius, float invTimeHorizon, float invTimeStep, Plane &plane)
+	{
+		const float distSq = absSq(relativePosition);
+		const float combinedRadiusSq = sqr(combinedRadius);
+
+		Vector3 u;
+
+		if (distSq > combinedRadiusSq) {
+			/* No collision. */
+			const Vector3 w = relativeVelocity - invTimeHorizon * relativePosition;
+			/* Vector from cutoff center to relative velocity. */
+			const float wLengthSq = absSq(w);
+
+			const float dotProduct = w * relativePosition;
+
+			if (dotProduct < 0.0f && sqr(dotProduct) > combinedRadiusSq * wLengthSq) {
+				/* Project on cut-off circle. */
+				const float wLength = std::sqrt(wLengthSq);
+				const Vector3 unitW = w / wLength;
+
+				plane.normal = unitW;
+				u = (combinedRadius * invTimeHorizon - wLength) * unitW;
 			}
 			else {
-				/* Collision. */
-				const float invTimeStep = 1.0f / sim_->timeStep_;
-				const Vector3 w = relativeVelocity - invTimeStep * relativePosition;
+				/* Project on cone. */
+				const float a = distSq;
+				const float b = relativePosition * relativeVelocity;
+				const float c = absSq(relativeVelocity) - absSq(cross(relativePosition, relativeVelocity)) / (distSq - combinedRadiusSq);
+				const float t = (b + std::sqrt(sqr(b) - a * c)) / a;
+				const Vector3 w = relativeVelocity - t * relativePosition;
 				const float wLength = abs(w);
 				const Vector3 unitW = w / wLength;
 
 				plane.normal = unitW;
-				u = (combinedRadius * invTimeStep - wLength) * unitW;
+				u = (combinedRadius * t - wLength) * unitW;
 			}
+		}
+		else {
+			/* Collision. */
+			const Vector3 w = relativeVelocity - invTimeStep * relativePosition;
+			const float wLength = abs(w);
+			const Vector3 unitW = w / wLength;
+
+			plane.normal = unitW;
+			u = (combinedRadius * invTimeStep - wLength) * unitW;
+		}
+
+		return u;
+	}
+
+	AgentSolver::AgentSolver(RVOSimulator *sim) : sim_(sim), index_(0), numNoNeighbors_(0), numUnconstrained_(0), numLinearProgram3_(0), numLinearProgram4_(0), numPlanar_(0), numAsleep_(0) { }
+
+	void AgentSolver::computeNeighbors(size_t index)
+	{
+		index_ = index;
+		agentNeighbors_.clear();
+		obstacleNeighbors_.clear();
+
+		/* Obstacles don't move, so only those the agent can reach within
+		 * the time horizon matter. */
+		const float obstacleRange = sim_->timeHorizons_[index] * sim_->maxSpeeds_[index] + sim_->radii_[index];
+		sim_->kdTree_->computeObstacleNeighbors(this, sim_->positions_[index], obstacleRange);
+
+		const size_t maxNeighbors = sim_->maxNeighbors_[index];
+
+		if (maxNeighbors > 0) {
+			agentNeighbors_.reserve(maxNeighbors);
+
+			if (sim_->hasNeighborList_[index]) {
+				/* Candidates supplied by the user, sorted and limited the
+				 * same way as those the kd-tree finds. */
+				const std::vector<size_t> &candidates = sim_->neighborLists_[index];
+				float rangeSq = sqr(sim_->neighborDists_[index]);
 
-			plane.point = velocity_ + 0.5f * u;
+				for (size_t i = 0; i < candidates.size(); ++i) {
+					if (sim_->hasAgent(candidates[i])) {
+						const size_t other = sim_->agentIndex(candidates[i]);
+						insertAgentNeighbor(other, sim_->positions_[other], rangeSq);
+					}
+				}
+			}
+			else {
+				sim_->kdTree_->computeAgentNeighbors(this, sim_->positions_[index], sqr(sim_->neighborDists_[index]));
+			}
+		}
+
+		if (isMoving(index)) {
+			for (size_t i = 0; i < agentNeighbors_.size(); ++i) {
+				if (sim_->asleep_[agentNeighbors_[i].second]) {
+					wakeAgents_.push_back(agentNeighbors_[i].second);
+				}
+			}
+		}
+	}
+
+	bool AgentSolver::canSleep() const
+	{
+		if (absSq(sim_->newVelocities_[index_]) > sqr(RVO_SLEEP_SPEED) || absSq(sim_->prefVelocities_[index_]) > sqr(RVO_SLEEP_SPEED)) {
+			return false;
+		}
+
+		for (size_t i = 0; i < agentNeighbors_.size(); ++i) {
+			if (isMoving(agentNeighbors_[i].second)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool AgentSolver::isMoving(size_t index) const
+	{
+		return absSq(sim_->velocities_[index]) > sqr(RVO_SLEEP_SPEED) || absSq(sim_->prefVelocities_[index]) > sqr(RVO_SLEEP_SPEED);
+	}
+
+	void AgentSolver::wakeNeighbors(size_t index)
+	{
+		if (isMoving(index)) {
+			sim_->kdTree_->computeSleepingAgents(this, sim_->positions_[index], sqr(sim_->neighborDists_[index]));
+		}
+	}
+
+	void AgentSolver::computeNewVelocity()
+	{
+		const size_t self = index_;
+		const Vector3 &position = sim_->positions_[self];
+		const Vector3 &velocity = sim_->velocities_[self];
+		const float radius = sim_->radii_[self];
+
+		const float maxSpeed = sim_->maxSpeeds_[self];
+		const Vector3 &prefVelocity = sim_->prefVelocities_[self];
+		Vector3 &newVelocity = sim_->newVelocities_[self];
+
+		/* The preferred velocity, clamped to the maximum speed, is where
+		 * linearProgram3 starts, and its result when no plane cuts it off. */
+		if (absSq(prefVelocity) > sqr(maxSpeed)) {
+			newVelocity = normalize(prefVelocity) * maxSpeed;
+		}
+		else {
+			newVelocity = prefVelocity;
+		}
+
+		if (obstacleNeighbors_.empty() && agentNeighbors_.empty()) {
+			++numNoNeighbors_;
+			return;
+		}
+
+#if RVO_PLANAR
+		if (isPlanar()) {
+			computePlanarVelocity();
+			return;
+		}
+#endif
+
+		orcaPlanes_.clear();
+		orcaPlanes_.reserve(obstacleNeighbors_.size() + agentNeighbors_.size());
+
+		/* Each plane is checked against that velocity as it is made, so
+		 * the linear programs only run for agents in conflict. */
+		bool conflict = false;
+
+		const float invTimeHorizon = 1.0f / sim_->timeHorizons_[self];
+		const float invTimeStep = 1.0f / sim_->timeStep_;
+
+		/* Create obstacle ORCA planes. The obstacles don't take their half
+		 * of the avoidance, so the agent takes all of it. */
+		for (size_t i = 0; i < obstacleNeighbors_.size(); ++i) {
+			const size_t obstacle = obstacleNeighbors_[i];
+			const Vector3 relativePosition = sim_->kdTree_->obstacleCenters_[obstacle] - position;
+			const float combinedRadius = radius + sim_->kdTree_->obstacleRadii_[obstacle];
+
+			Plane plane;
+			const Vector3 u = computeORCAChange(relativePosition, velocity, combinedRadius, invTimeHorizon, invTimeStep, plane);
+
+			plane.point = velocity + u;
+			orcaPlanes_.push_back(plane);
+			conflict |= plane.normal * (plane.point - newVelocity) > 0.0f;
+		}
+
+		/* Create agent ORCA planes. */
+		for (size_t i = 0; i < agentNeighbors_.size(); ++i) {
+			const size_t other = agentNeighbors_[i].second;
+			const Vector3 relativePosition = sim_->positions_[other] - position;
+			const Vector3 relativeVelocity = velocity - sim_->velocities_[other];
+			const float combinedRadius = radius + sim_->radii_[other];
+
+			Plane plane;
+			const Vector3 u = computeORCAChange(relativePosition, relativeVelocity, combinedRadius, invTimeHorizon, invTimeStep, plane);
+
+			plane.point = velocity + 0.5f * u;
 			orcaPlanes_.push_back(plane);
+			conflict |= plane.normal * (plane.point - newVelocity) > 0.0f;
+		}
+
+		if (!conflict) {
+			++numUnconstrained_;
+			return;
 		}
 
-		const size_t planeFail = linearProgram3(orcaPlanes_, maxSpeed_, prefVelocity_, false, newVelocity_);
+		const size_t planeFail = linearProgram3(orcaPlanes_, maxSpeed, prefVelocity, false, newVelocity);
 
 		if (planeFail < orcaPlanes_.size()) {
-			linearProgram4(orcaPlanes_, planeFail, maxSpeed_, newVelocity_);
+			++numLinearProgram4_;
+			linearProgram4(orcaPlanes_, planeFail, maxSpeed, projPlanes_, newVelocity);
+		}
+		else {
+			++numLinearProgram3_;
 		}
 	}
 
-	void Agent::insertAgentNeighbor(const Agent *agent, float &rangeSq)
+#if RVO_PLANAR
+	bool AgentSolver::isPlanar() const
 	{
-		if (this != agent) {
-			const float distSq = absSq(position_ - agent->position_);
+		const float tolerance = sim_->planarTolerance_;
+
+		if (tolerance < 0.0f) {
+			return false;
+		}
+
+		/* The gap in z to each neighbor must be within the tolerance now
+		 * and at the time horizon, and so in between. The agent moves
+		 * along z at the speed computePlanarVelocity() gives it, not at
+		 * its current one. */
+		const float z = sim_->positions_[index_].z();
+		const float maxSpeed = sim_->maxSpeeds_[index_];
+		const float velocityZ = std::max(-maxSpeed, std::min(maxSpeed, sim_->prefVelocities_[index_].z()));
+		const float timeHorizon = sim_->timeHorizons_[index_];
+
+		for (size_t i = 0; i < obstacleNeighbors_.size(); ++i) {
+			const float gap = sim_->kdTree_->obstacleCenters_[obstacleNeighbors_[i]].z() - z;
+
+			if (std::fabs(gap) > tolerance || std::fabs(gap - timeHorizon * velocityZ) > tolerance) {
+				return false;
+			}
+		}
+
+		for (size_t i = 0; i < agentNeighbors_.size(); ++i) {
+			const size_t other = agentNeighbors_[i].second;
+			const float gap = sim_->positions_[other].z() - z;
+
+			if (std::fabs(gap) > tolerance || std::fabs(gap + timeHorizon * (sim_->velocities_[other].z() - velocityZ)) > tolerance) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void AgentSolver::computePlanarVelocity()
+	{
+		const size_t self = index_;
+		const Vector3 &position = sim_->positions_[self];
+		const Vector3 &velocity = sim_->velocities_[self];
+		const Vector3 &prefVelocity = sim_->prefVelocities_[self];
+		const float radius = sim_->radii_[self];
+		const float maxSpeed = sim_->maxSpeeds_[self];
+
+		/* The agent keeps its preferred speed along z, and avoids in the
+		 * plane with what is left of its maximum speed. Its neighbors are
+		 * vertical cylinders rather than spheres. */
+		const float velocityZ = std::max(-maxSpeed, std::min(maxSpeed, prefVelocity.z()));
+		const float planarMaxSpeed = std::sqrt(sqr(maxSpeed) - sqr(velocityZ));
+		const Vector3 planarPrefVelocity(prefVelocity.x(), prefVelocity.y(), 0.0f);
+		const Vector3 planarVelocity(velocity.x(), velocity.y(), 0.0f);
+
+		Vector3 result;
+
+		if (absSq(planarPrefVelocity) > sqr(planarMaxSpeed)) {
+			result = normalize(planarPrefVelocity) * planarMaxSpeed;
+		}
+		else {
+			result = planarPrefVelocity;
+		}
+
+		orcaLines_.clear();
+		orcaLines_.reserve(obstacleNeighbors_.size() + agentNeighbors_.size());
+		bool conflict = false;
+
+		const float invTimeHorizon = 1.0f / sim_->timeHorizons_[self];
+		const float invTimeStep = 1.0f / sim_->timeStep_;
+
+		for (size_t i = 0; i < obstacleNeighbors_.size(); ++i) {
+			const size_t obstacle = obstacleNeighbors_[i];
+			const Vector3 &center = sim_->kdTree_->obstacleCenters_[obstacle];
+			const Vector3 relativePosition(center.x() - position.x(), center.y() - position.y(), 0.0f);
+			const float combinedRadius = radius + sim_->kdTree_->obstacleRadii_[obstacle];
+
+			Line line;
+			const Vector3 u = computePlanarORCAChange(relativePosition, planarVelocity, combinedRadius, invTimeHorizon, invTimeStep, line);
+
+			line.point = planarVelocity + u;
+			orcaLines_.push_back(line);
+			conflict |= det(line.direction, line.point - result) > 0.0f;
+		}
+
+		for (size_t i = 0; i < agentNeighbors_.size(); ++i) {
+			const size_t other = agentNeighbors_[i].second;
+			const Vector3 &otherPosition = sim_->positions_[other];
+			const Vector3 &otherVelocity = sim_->velocities_[other];
+			const Vector3 relativePosition(otherPosition.x() - position.x(), otherPosition.y() - position.y(), 0.0f);
+			const Vector3 relativeVelocity(velocity.x() - otherVelocity.x(), velocity.y() - otherVelocity.y(), 0.0f);
+			const float combinedRadius = radius + sim_->radii_[other];
+
+			Line line;
+			const Vector3 u = computePlanarORCAChange(relativePosition, relativeVelocity, combinedRadius, invTimeHorizon, invTimeStep, line);
+
+			line.point = planarVelocity + 0.5f * u;
+			orcaLines_.push_back(line);
+			conflict |= det(line.direction, line.point - result) > 0.0f;
+		}
+
+		++numPlanar_;
+
+		if (!conflict) {
+			++numUnconstrained_;
+		}
+		else {
+			const size_t lineFail = planarProgram2(orcaLines_, planarMaxSpeed, planarPrefVelocity, false, result);
+
+			if (lineFail < orcaLines_.size()) {
+				++numLinearProgram4_;
+				planarProgram3(orcaLines_, lineFail, planarMaxSpeed, projLines_, result);
+			}
+			else {
+				++numLinearProgram3_;
+			}
+		}
+
+		sim_->newVelocities_[self] = Vector3(result.x(), result.y(), velocityZ);
+	}
+#endif
+
+	void AgentSolver::insertObstacleNeighbor(size_t obstacle)
+	{
+		obstacleNeighbors_.push_back(obstacle);
+	}
+
+	void AgentSolver::insertAgentNeighbor(size_t index, const Vector3 &position, float &rangeSq)
+	{
+		if (index != index_ && (sim_->groups_[index] == RVO_NO_GROUP || sim_->groups_[index] != sim_->groups_[index_])) {
+			const float distSq = absSq(sim_->positions_[index_] - position);
 
 			if (distSq < rangeSq) {
-				if (agentNeighbors_.size() < maxNeighbors_) {
-					agentNeighbors_.push_back(std::make_pair(distSq, agent));
+				const size_t maxNeighbors = sim_->maxNeighbors_[index_];
+
+				if (agentNeighbors_.size() < maxNeighbors) {
+					agentNeighbors_.push_back(std::make_pair(distSq, index));
 				}
 
 				size_t i = agentNeighbors_.size() - 1;
@@ -202,21 +564,15 @@ namespace RVO {
 					--i;
 				}
 
-				agentNeighbors_[i] = std::make_pair(distSq, agent);
+				agentNeighbors_[i] = std::make_pair(distSq, index);
 
-				if (agentNeighbors_.size() == maxNeighbors_) {
+				if (agentNeighbors_.size() == maxNeighbors) {
 					rangeSq = agentNeighbors_.back().first;
 				}
 			}
 		}
 	}
 
-	void Agent::update()
-	{
-		velocity_ = newVelocity_;
-		position_ += velocity_ * sim_->timeStep_;
-	}
-
 	bool linearProgram1(const std::vector<Plane> &planes, size_t planeNo, const Line &line, float radius, const Vector3 &optVelocity, bool directionOpt, Vector3 &result)
 	{
 		const float dotProduct = line.point * line.direction;
@@ -384,14 +740,14 @@ namespace RVO {
 		return planes.size();
 	}
 
-	void linearProgram4(const std::vector<Plane> &planes, size_t beginPlane, float radius, Vector3 &result)
+	void linearProgram4(const std::vector<Plane> &planes, size_t beginPlane, float radius, std::vector<Plane> &projPlanes, Vector3 &result)
 	{
 		float distance = 0.0f;
 
 		for (size_t i = beginPlane; i < planes.size(); ++i) {
 			if (planes[i].normal * (planes[i].point - result) > distance) {
 				/* Result does not satisfy constraint of plane i. */
-				std::vector<Plane> projPlanes;
+				projPlanes.clear();
 
 				for (size_t j = 0; j < i; ++j) {
 					Plane plane;
@@ -430,4 +786,154 @@ namespace RVO {
 			}
 		}
 	}
+
+#if RVO_PLANAR
+	bool planarProgram1(const std::vector<Line> &lines, size_t lineNo, float radius, const Vector3 &optVelocity, bool directionOpt, Vector3 &result)
+	{
+		const float dotProduct = lines[lineNo].point * lines[lineNo].direction;
+		const float discriminant = sqr(dotProduct) + sqr(radius) - absSq(lines[lineNo].point);
+
+		if (discriminant < 0.0f) {
+			/* Max speed circle fully invalidates line lineNo. */
+			return false;
+		}
+
+		const float sqrtDiscriminant = std::sqrt(discriminant);
+		float tLeft = -dotProduct - sqrtDiscriminant;
+		float tRight = -dotProduct + sqrtDiscriminant;
+
+		for (size_t i = 0; i < lineNo; ++i) {
+			const float denominator = det(lines[lineNo].direction, lines[i].direction);
+			const float numerator = det(lines[i].direction, lines[lineNo].point - lines[i].point);
+
+			if (std::fabs(denominator) <= RVO_EPSILON) {
+				/* Lines lineNo and i are (almost) parallel. */
+				if (numerator < 0.0f) {
+					return false;
+				}
+				else {
+					continue;
+				}
+			}
+
+			const float t = numerator / denominator;
+
+			if (denominator >= 0.0f) {
+				/* Line i bounds line lineNo on the right. */
+				tRight = std::min(tRight, t);
+			}
+			else {
+				/* Line i bounds line lineNo on the left. */
+				tLeft = std::max(tLeft, t);
+			}
+
+			if (tLeft > tRight) {
+				return false;
+			}
+		}
+
+		if (directionOpt) {
+			/* Optimize direction. */
+			if (optVelocity * lines[lineNo].direction > 0.0f) {
+				/* Take right extreme. */
+				result = lines[lineNo].point + tRight * lines[lineNo].direction;
+			}
+			else {
+				/* Take left extreme. */
+				result = lines[lineNo].point + tLeft * lines[lineNo].direction;
+			}
+		}
+		else {
+			/* Optimize closest point. */
+			const float t = lines[lineNo].direction * (optVelocity - lines[lineNo].point);
+
+			if (t < tLeft) {
+				result = lines[lineNo].point + tLeft * lines[lineNo].direction;
+			}
+			else if (t > tRight) {
+				result = lines[lineNo].point + tRight * lines[lineNo].direction;
+			}
+			else {
+				result = lines[lineNo].point + t * lines[lineNo].direction;
+			}
+		}
+
+		return true;
+	}
+
+	size_t planarProgram2(const std::vector<Line> &lines, float radius, const Vector3 &optVelocity, bool directionOpt, Vector3 &result)
+	{
+		if (directionOpt) {
+			/* Optimize direction. Note that the optimization velocity is of unit length in this case. */
+			result = optVelocity * radius;
+		}
+		else if (absSq(optVelocity) > sqr(radius)) {
+			/* Optimize closest point and outside circle. */
+			result = normalize(optVelocity) * radius;
+		}
+		else {
+			/* Optimize closest point and inside circle. */
+			result = optVelocity;
+		}
+
+		for (size_t i = 0; i < lines.size(); ++i) {
+			if (det(lines[i].direction, lines[i].point - result) > 0.0f) {
+				/* Result does not satisfy constraint i. Compute new optimal result. */
+				const Vector3 tempResult = result;
+
+				if (!planarProgram1(lines, i, radius, optVelocity, directionOpt, result)) {
+					result = tempResult;
+					return i;
+				}
+			}
+		}
+
+		return lines.size();
+	}
+
+	void planarProgram3(const std::vector<Line> &lines, size_t beginLine, float radius, std::vector<Line> &projLines, Vector3 &result)
+	{
+		float distance = 0.0f;
+
+		for (size_t i = beginLine; i < lines.size(); ++i) {
+			if (det(lines[i].direction, lines[i].point - result) > distance) {
+				/* Result does not satisfy constraint of line i. */
+				projLines.clear();
+
+				for (size_t j = 0; j < i; ++j) {
+					Line line;
+
+					const float determinant = det(lines[i].direction, lines[j].direction);
+
+					if (std::fabs(determinant) <= RVO_EPSILON) {
+						/* Line i and line j are (almost) parallel. */
+						if (lines[i].direction * lines[j].direction > 0.0f) {
+							/* Line i and line j point in the same direction. */
+							continue;
+						}
+						else {
+							/* Line i and line j point in opposite direction. */
+							line.point = 0.5f * (lines[i].point + lines[j].point);
+						}
+					}
+					else {
+						line.point = lines[i].point + (det(lines[j].direction, lines[i].point - lines[j].point) / determinant) * lines[i].direction;
+					}
+
+					line.direction = normalize(lines[j].direction - lines[i].direction);
+					projLines.push_back(line);
+				}
+
+				const Vector3 tempResult = result;
+
+				if (planarProgram2(projLines, radius, Vector3(-lines[i].direction.y(), lines[i].direction.x(), 0.0f), true, result) < projLines.size()) {
+					/* This should in principle not happen.  The result is by definition already in the feasible region of this linear program. If it fails, it is due to small floating point error, and the current result is kept. */
+					result = tempResult;
+				}
+
+				distance = det(lines[i].direction, lines[i].point - result);
+			}
+		}
+	}
+#endif
 }
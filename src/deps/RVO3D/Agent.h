@@ -32,7 +32,7 @@
 
 /**
  * \file    Agent.h
- * \brief   Contains the Agent class.
+ * \brief   Contains the AgentSolver class.
  */
 #ifndef RVO_AGENT_H_
 #define RVO_AGENT_H_
@@ -43,56 +43,122 @@
 #include <utility>
 #include <vector>
 
+#include "Definitions.h"
 #include "RVOSimulator.h"
 #include "Vector3.h"
 
 namespace RVO {
 	/**
-	 * \brief   Defines an agent in the simulation.
+	 * \brief   Defines a directed line.
 	 */
-	class Agent {
+	class Line {
+	public:
+		/**
+		 * \brief   The direction of the directed line.
+		 */
+		Vector3 direction;
+
+		/**
+		 * \brief   A point on the directed line.
+		 */
+		Vector3 point;
+	};
+
+	/**
+	 * \brief   Computes the new velocities of agents in the simulation, one
+	 *          agent at a time. The agents themselves are stored in the
+	 *          arrays of RVOSimulator; this only holds the neighbor and
+	 *          plane buffers, which are reused from agent to agent so that
+	 *          a step doesn't allocate. Each thread has its own.
+	 */
+	class AgentSolver {
 	private:
 		/**
-		 * \brief   Constructs an agent instance.
+		 * \brief   Constructs a solver instance.
 		 * \param   sim  The simulator instance.
 		 */
-		explicit Agent(RVOSimulator *sim);
+		explicit AgentSolver(RVOSimulator *sim);
 
 		/**
-		 * \brief   Computes the neighbors of this agent.
+		 * \brief   Computes the neighbors of the specified agent.
+		 * \param   index  The index of the agent in the agent arrays, not its handle.
 		 */
-		void computeNeighbors();
+		void computeNeighbors(size_t index);
 
 		/**
-		 * \brief   Computes the new velocity of this agent.
+		 * \brief   Computes the new velocity of the agent whose neighbors were computed last.
 		 */
 		void computeNewVelocity();
 
 		/**
-		 * \brief   Inserts an agent neighbor into the set of neighbors of this agent.
-		 * \param   agent    A pointer to the agent to be inserted.
-		 * \param   rangeSq  The squared range around this agent.
+		 * \brief   Returns whether the agent whose new velocity was computed last can be put to sleep, see RVO::RVO_SLEEP_SPEED.
+		 * \return  True if the agent and all of its agent neighbors are still and prefer to be.
+		 */
+		bool canSleep() const;
+
+		/**
+		 * \brief   Returns whether an agent is moving or about to, and so wakes its sleeping neighbors.
+		 * \param   index  The index of the agent in the agent arrays, not its handle.
+		 * \return  True if the velocity or preferred velocity of the agent is above the sleep speed.
+		 */
+		bool isMoving(size_t index) const;
+
+		/**
+		 * \brief   Wakes all sleeping agents within the neighbor distance of an agent that doesn't avoid collisions, if it is moving, since it takes no neighbors to wake them through.
+		 * \param   index  The index of the agent in the agent arrays, not its handle.
 		 */
-		void insertAgentNeighbor(const Agent *agent, float &rangeSq);
+		void wakeNeighbors(size_t index);
 
+#if RVO_PLANAR
 		/**
-		 * \brief   Updates the three-dimensional position and three-dimensional velocity of this agent.
+		 * \brief   Returns whether the agent whose neighbors were computed last stays close enough to the z of all of them to be solved in the plane.
+		 * \return  True if the agent can be solved in the plane.
 		 */
-		void update();
+		bool isPlanar() const;
+
+		/**
+		 * \brief   Computes the new velocity of the agent whose neighbors were computed last in the plane, with ORCA lines in place of ORCA planes.
+		 */
+		void computePlanarVelocity();
+#endif
+
+		/**
+		 * \brief   Inserts an agent neighbor into the set of neighbors of the current agent, unless it is the current agent or in its group.
+		 * \param   index     The index in the agent arrays of the agent to be inserted, not its handle.
+		 * \param   position  The position of the agent to be inserted.
+		 * \param   rangeSq   The squared range around the current agent.
+		 */
+		void insertAgentNeighbor(size_t index, const Vector3 &position, float &rangeSq);
+
+		/**
+		 * \brief   Inserts a static obstacle into the set of obstacles near the current agent.
+		 * \param   obstacle  The number of the obstacle in the obstacle tree.
+		 */
+		void insertObstacleNeighbor(size_t obstacle);
 
-		Vector3 newVelocity_;
-		Vector3 position_;
-		Vector3 prefVelocity_;
-		Vector3 velocity_;
 		RVOSimulator *sim_;
-		size_t id_;
-		size_t maxNeighbors_;
-		float maxSpeed_;
-		float neighborDist_;
-		float radius_;
-		float timeHorizon_;
-		std::vector<std::pair<float, const Agent *> > agentNeighbors_;
+		size_t index_;
+		std::vector<std::pair<float, size_t> > agentNeighbors_;
+		std::vector<size_t> obstacleNeighbors_;
 		std::vector<Plane> orcaPlanes_;
+		std::vector<Plane> projPlanes_;
+#if RVO_PLANAR
+		std::vector<Line> orcaLines_;
+		std::vector<Line> projLines_;
+#endif
+
+		/* How the new velocities were found, since the start of the step. */
+		size_t numNoNeighbors_;
+		size_t numUnconstrained_;
+		size_t numLinearProgram3_;
+		size_t numLinearProgram4_;
+		size_t numPlanar_;
+		size_t numAsleep_;
+
+		/* Sleeping agents that moving agents took as neighbors, or came
+		 * near without avoiding them, in this step; woken once all new
+		 * velocities have been computed. */
+		std::vector<size_t> wakeAgents_;
 
 		friend class KdTree;
 		friend class RVOSimulator;
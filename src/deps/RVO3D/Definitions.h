@@ -40,6 +40,13 @@
 
 #include "API.h"
 
+/**
+ * \brief   Whether agents whose neighbors are all at about the same z are solved in the plane, see RVOSimulator::setPlanarTolerance. Define as 0 to build the three-dimensional solver only.
+ */
+#ifndef RVO_PLANAR
+#define RVO_PLANAR 1
+#endif
+
 namespace RVO {
 	/**
 	 * \brief   Computes the square of a float.
@@ -33,40 +33,153 @@
 #include "KdTree.h"
 
 #include <algorithm>
+#include <limits>
 
 #include "Agent.h"
 #include "Definitions.h"
 #include "RVOSimulator.h"
+#include "TaskPool.h"
 
 namespace RVO {
 	const size_t RVO_MAX_LEAF_SIZE = 10;
 
+	/**
+	 * \brief   The maximum number of obstacles in a leaf of the obstacle tree.
+	 */
+	const size_t RVO_MAX_OBSTACLE_LEAF_SIZE = 4;
+
+	/**
+	 * \brief   How much the children of internal nodes may overlap along their split coordinate, relative to the extent of their parents, before a refitted tree is rebuilt.
+	 */
+	const float RVO_MAX_TREE_OVERLAP = 0.2f;
+
+	/**
+	 * \brief   The depth of the subtrees that are built and refitted as separate tasks. It does not depend on the number of threads, so neither does the tree.
+	 */
+	const size_t RVO_TREE_TASK_DEPTH = 4;
+
+	/**
+	 * \brief   The number of agents below which the subtree tasks are run on the calling thread.
+	 */
+	const size_t RVO_MIN_PARALLEL_TREE_SIZE = 2048;
+
+	/**
+	 * \brief   A depth that is never reached.
+	 */
+	const size_t RVO_NO_TASK_DEPTH = std::numeric_limits<size_t>::max();
+
 	KdTree::KdTree(RVOSimulator *sim) : sim_(sim) { }
 
 	void KdTree::buildAgentTree()
 	{
-		agents_ = sim_->agents_;
+		const size_t numAgents = sim_->positions_.size();
+
+		/* The order of the last build is still a permutation of the agents,
+		 * and close to the order of this one, unless agents came or went. */
+		const bool refit = agents_.size() == numAgents && !agentTree_.empty();
+
+		if (agents_.size() != numAgents) {
+			agents_.resize(numAgents);
+
+			for (size_t i = 0; i < numAgents; ++i) {
+				agents_[i] = i;
+			}
+		}
 
-		if (!agents_.empty()) {
-			agentTree_.resize(2 * agents_.size() - 1);
-			buildAgentTreeRecursive(0, agents_.size(), 0);
+		positions_.resize(numAgents);
+
+		for (size_t i = 0; i < numAgents; ++i) {
+			positions_[i] = sim_->positions_[agents_[i]];
+		}
+
+		if (refit) {
+			subtrees_.clear();
+			collectSubtrees(0, RVO_TREE_TASK_DEPTH);
+			subtreeOverlaps_.assign(subtrees_.size(), 0.0f);
+			subtreeExtents_.assign(subtrees_.size(), 0.0f);
+
+			runSubtreeTasks([this](size_t i) {
+				refitAgentTreeRecursive(subtrees_[i], RVO_NO_TASK_DEPTH, subtreeOverlaps_[i], subtreeExtents_[i]);
+			});
+
+			/* The parts above the subtrees, then the subtrees in order. */
+			float overlap = 0.0f;
+			float extent = 0.0f;
+			refitAgentTreeRecursive(0, RVO_TREE_TASK_DEPTH, overlap, extent);
+
+			for (size_t i = 0; i < subtrees_.size(); ++i) {
+				overlap += subtreeOverlaps_[i];
+				extent += subtreeExtents_[i];
+			}
+
+			if (overlap <= RVO_MAX_TREE_OVERLAP * extent) {
+				return;
+			}
+		}
+
+		if (numAgents > 0) {
+			agentTree_.resize(2 * numAgents - 1);
+			subtrees_.clear();
+			buildAgentTreeRecursive(0, numAgents, 0, RVO_TREE_TASK_DEPTH);
+
+			runSubtreeTasks([this](size_t i) {
+				const AgentTreeNode &node = agentTree_[subtrees_[i]];
+				buildAgentTreeRecursive(node.begin, node.end, subtrees_[i], RVO_NO_TASK_DEPTH);
+			});
+		}
+		else {
+			agentTree_.clear();
 		}
 	}
 
-	void KdTree::buildAgentTreeRecursive(size_t begin, size_t end, size_t node)
+	void KdTree::runSubtreeTasks(const std::function<void(size_t)> &task)
+	{
+		if (agents_.size() < RVO_MIN_PARALLEL_TREE_SIZE) {
+			for (size_t i = 0; i < subtrees_.size(); ++i) {
+				task(i);
+			}
+		}
+		else {
+			sim_->taskPool_->parallelFor(subtrees_.size(), 1, [&task](size_t, size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					task(i);
+				}
+			});
+		}
+	}
+
+	void KdTree::collectSubtrees(size_t node, size_t depth)
+	{
+		if (depth == 0) {
+			subtrees_.push_back(node);
+		}
+		else if (agentTree_[node].end - agentTree_[node].begin > RVO_MAX_LEAF_SIZE) {
+			collectSubtrees(agentTree_[node].left, depth - 1);
+			collectSubtrees(agentTree_[node].right, depth - 1);
+		}
+	}
+
+	void KdTree::buildAgentTreeRecursive(size_t begin, size_t end, size_t node, size_t depth)
 	{
 		agentTree_[node].begin = begin;
 		agentTree_[node].end = end;
-		agentTree_[node].minCoord = agents_[begin]->position_;
-		agentTree_[node].maxCoord = agents_[begin]->position_;
+
+		if (depth == 0) {
+			/* Built later as a separate task. */
+			subtrees_.push_back(node);
+			return;
+		}
+
+		agentTree_[node].minCoord = positions_[begin];
+		agentTree_[node].maxCoord = positions_[begin];
 
 		for (size_t i = begin + 1; i < end; ++i) {
-			agentTree_[node].maxCoord[0] = std::max(agentTree_[node].maxCoord[0], agents_[i]->position_.x());
-			agentTree_[node].minCoord[0] = std::min(agentTree_[node].minCoord[0], agents_[i]->position_.x());
-			agentTree_[node].maxCoord[1] = std::max(agentTree_[node].maxCoord[1], agents_[i]->position_.y());
-			agentTree_[node].minCoord[1] = std::min(agentTree_[node].minCoord[1], agents_[i]->position_.y());
-			agentTree_[node].maxCoord[2] = std::max(agentTree_[node].maxCoord[2], agents_[i]->position_.z());
-			agentTree_[node].minCoord[2] = std::min(agentTree_[node].minCoord[2], agents_[i]->position_.z());
+			agentTree_[node].maxCoord[0] = std::max(agentTree_[node].maxCoord[0], positions_[i].x());
+			agentTree_[node].minCoord[0] = std::min(agentTree_[node].minCoord[0], positions_[i].x());
+			agentTree_[node].maxCoord[1] = std::max(agentTree_[node].maxCoord[1], positions_[i].y());
+			agentTree_[node].minCoord[1] = std::min(agentTree_[node].minCoord[1], positions_[i].y());
+			agentTree_[node].maxCoord[2] = std::max(agentTree_[node].maxCoord[2], positions_[i].z());
+			agentTree_[node].minCoord[2] = std::min(agentTree_[node].minCoord[2], positions_[i].z());
 		}
 
 		if (end - begin > RVO_MAX_LEAF_SIZE) {
@@ -83,6 +196,8 @@ namespace RVO {
 				coord = 2;
 			}
 
+			agentTree_[node].coord = coord;
+
 			const float splitValue = 0.5f * (agentTree_[node].maxCoord[coord] + agentTree_[node].minCoord[coord]);
 
 			size_t left = begin;
@@ -90,16 +205,17 @@ namespace RVO {
 			size_t right = end;
 
 			while (left < right) {
-				while (left < right && agents_[left]->position_[coord] < splitValue) {
+				while (left < right && positions_[left][coord] < splitValue) {
 					++left;
 				}
 
-				while (right > left && agents_[right - 1]->position_[coord] >= splitValue) {
+				while (right > left && positions_[right - 1][coord] >= splitValue) {
 					--right;
 				}
 
 				if (left < right) {
 					std::swap(agents_[left], agents_[right - 1]);
+					std::swap(positions_[left], positions_[right - 1]);
 					++left;
 					--right;
 				}
@@ -116,46 +232,225 @@ namespace RVO {
 			agentTree_[node].left = node + 1;
 			agentTree_[node].right = node + 2 * leftSize;
 
-			buildAgentTreeRecursive(begin, left, agentTree_[node].left);
-			buildAgentTreeRecursive(left, end, agentTree_[node].right);
+			buildAgentTreeRecursive(begin, left, agentTree_[node].left, depth - 1);
+			buildAgentTreeRecursive(left, end, agentTree_[node].right, depth - 1);
+		}
+	}
+
+	void KdTree::refitAgentTreeRecursive(size_t node, size_t depth, float &overlap, float &extent)
+	{
+		if (depth == 0) {
+			/* Refitted as a separate task. */
+			return;
+		}
+
+		AgentTreeNode &treeNode = agentTree_[node];
+
+		if (treeNode.end - treeNode.begin <= RVO_MAX_LEAF_SIZE) {
+			treeNode.minCoord = positions_[treeNode.begin];
+			treeNode.maxCoord = positions_[treeNode.begin];
+
+			for (size_t i = treeNode.begin + 1; i < treeNode.end; ++i) {
+				for (size_t k = 0; k < 3; ++k) {
+					treeNode.maxCoord[k] = std::max(treeNode.maxCoord[k], positions_[i][k]);
+					treeNode.minCoord[k] = std::min(treeNode.minCoord[k], positions_[i][k]);
+				}
+			}
+		}
+		else {
+			refitAgentTreeRecursive(treeNode.left, depth - 1, overlap, extent);
+			refitAgentTreeRecursive(treeNode.right, depth - 1, overlap, extent);
+
+			const AgentTreeNode &left = agentTree_[treeNode.left];
+			const AgentTreeNode &right = agentTree_[treeNode.right];
+
+			for (size_t k = 0; k < 3; ++k) {
+				treeNode.maxCoord[k] = std::max(left.maxCoord[k], right.maxCoord[k]);
+				treeNode.minCoord[k] = std::min(left.minCoord[k], right.minCoord[k]);
+			}
+
+			const size_t coord = treeNode.coord;
+			overlap += std::max(0.0f, std::min(left.maxCoord[coord], right.maxCoord[coord]) - std::max(left.minCoord[coord], right.minCoord[coord]));
+			extent += treeNode.maxCoord[coord] - treeNode.minCoord[coord];
+		}
+	}
+
+	void KdTree::buildObstacleTree()
+	{
+		obstacles_.clear();
+
+		for (size_t i = 0; i < sim_->obstacleRadii_.size(); ++i) {
+			if (sim_->obstacleRadii_[i] >= 0.0f) {
+				obstacles_.push_back(i);
+			}
+		}
+
+		obstacleCenters_.resize(obstacles_.size());
+		obstacleRadii_.resize(obstacles_.size());
+		obstacleTree_.clear();
+
+		if (!obstacles_.empty()) {
+			buildObstacleTreeRecursive(0, obstacles_.size());
+		}
+
+		for (size_t i = 0; i < obstacles_.size(); ++i) {
+			obstacleCenters_[i] = sim_->obstacleCenters_[obstacles_[i]];
+			obstacleRadii_[i] = sim_->obstacleRadii_[obstacles_[i]];
 		}
 	}
 
-	void KdTree::computeAgentNeighbors(Agent *agent, float rangeSq) const
+	size_t KdTree::buildObstacleTreeRecursive(size_t begin, size_t end)
 	{
-		queryAgentTreeRecursive(agent, rangeSq, 0);
+		const std::vector<Vector3> &centers = sim_->obstacleCenters_;
+		const std::vector<float> &radii = sim_->obstacleRadii_;
+
+		const size_t node = obstacleTree_.size();
+		obstacleTree_.push_back(ObstacleTreeNode());
+
+		Vector3 minCoord = centers[obstacles_[begin]] - Vector3(1.0f, 1.0f, 1.0f) * radii[obstacles_[begin]];
+		Vector3 maxCoord = centers[obstacles_[begin]] + Vector3(1.0f, 1.0f, 1.0f) * radii[obstacles_[begin]];
+
+		for (size_t i = begin + 1; i < end; ++i) {
+			for (size_t k = 0; k < 3; ++k) {
+				minCoord[k] = std::min(minCoord[k], centers[obstacles_[i]][k] - radii[obstacles_[i]]);
+				maxCoord[k] = std::max(maxCoord[k], centers[obstacles_[i]][k] + radii[obstacles_[i]]);
+			}
+		}
+
+		size_t left = 0;
+		size_t right = 0;
+
+		if (end - begin > RVO_MAX_OBSTACLE_LEAF_SIZE) {
+			/* Split at the median center along the longest side. */
+			size_t coord = 0;
+
+			for (size_t k = 1; k < 3; ++k) {
+				if (maxCoord[k] - minCoord[k] > maxCoord[coord] - minCoord[coord]) {
+					coord = k;
+				}
+			}
+
+			const size_t middle = begin + (end - begin) / 2;
+			std::nth_element(obstacles_.begin() + begin, obstacles_.begin() + middle, obstacles_.begin() + end, [&centers, coord](size_t a, size_t b) {
+				return centers[a][coord] < centers[b][coord] || (centers[a][coord] == centers[b][coord] && a < b);
+			});
+
+			left = buildObstacleTreeRecursive(begin, middle);
+			right = buildObstacleTreeRecursive(middle, end);
+		}
+
+		ObstacleTreeNode &treeNode = obstacleTree_[node];
+		treeNode.begin = begin;
+		treeNode.end = end;
+		treeNode.left = left;
+		treeNode.right = right;
+		treeNode.minCoord = minCoord;
+		treeNode.maxCoord = maxCoord;
+
+		return node;
 	}
 
-	void KdTree::queryAgentTreeRecursive(Agent *agent, float &rangeSq, size_t node) const
+	void KdTree::computeObstacleNeighbors(AgentSolver *solver, const Vector3 &position, float range) const
+	{
+		if (!obstacleTree_.empty()) {
+			queryObstacleTreeRecursive(solver, position, range, 0);
+		}
+	}
+
+	void KdTree::queryObstacleTreeRecursive(AgentSolver *solver, const Vector3 &position, float range, size_t node) const
+	{
+		const ObstacleTreeNode &treeNode = obstacleTree_[node];
+
+		float distSq = 0.0f;
+
+		for (size_t k = 0; k < 3; ++k) {
+			distSq += sqr(std::max(0.0f, treeNode.minCoord[k] - position[k])) + sqr(std::max(0.0f, position[k] - treeNode.maxCoord[k]));
+		}
+
+		if (distSq >= sqr(range)) {
+			return;
+		}
+
+		if (treeNode.left == 0) {
+			for (size_t i = treeNode.begin; i < treeNode.end; ++i) {
+				if (abs(obstacleCenters_[i] - position) - obstacleRadii_[i] < range) {
+					solver->insertObstacleNeighbor(i);
+				}
+			}
+		}
+		else {
+			queryObstacleTreeRecursive(solver, position, range, treeNode.left);
+			queryObstacleTreeRecursive(solver, position, range, treeNode.right);
+		}
+	}
+
+	void KdTree::computeAgentNeighbors(AgentSolver *solver, const Vector3 &position, float rangeSq) const
+	{
+		if (!agentTree_.empty()) {
+			queryAgentTreeRecursive(solver, position, rangeSq, 0);
+		}
+	}
+
+	void KdTree::queryAgentTreeRecursive(AgentSolver *solver, const Vector3 &position, float &rangeSq, size_t node) const
 	{
 		if (agentTree_[node].end - agentTree_[node].begin <= RVO_MAX_LEAF_SIZE) {
 			for (size_t i = agentTree_[node].begin; i < agentTree_[node].end; ++i) {
-				agent->insertAgentNeighbor(agents_[i], rangeSq);
+				solver->insertAgentNeighbor(agents_[i], positions_[i], rangeSq);
 			}
 		}
 		else {
-			const float distSqLeft = sqr(std::max(0.0f, agentTree_[agentTree_[node].left].minCoord[0] - agent->position_.x())) + sqr(std::max(0.0f, agent->position_.x() - agentTree_[agentTree_[node].left].maxCoord[0])) + sqr(std::max(0.0f, agentTree_[agentTree_[node].left].minCoord[1] - agent->position_.y())) + sqr(std::max(0.0f, agent->position_.y() - agentTree_[agentTree_[node].left].maxCoord[1])) + sqr(std::max(0.0f, agentTree_[agentTree_[node].left].minCoord[2] - agent->position_.z())) + sqr(std::max(0.0f, agent->position_.z() - agentTree_[agentTree_[node].left].maxCoord[2]));
+			const float distSqLeft = sqr(std::max(0.0f, agentTree_[agentTree_[node].left].minCoord[0] - position.x())) + sqr(std::max(0.0f, position.x() - agentTree_[agentTree_[node].left].maxCoord[0])) + sqr(std::max(0.0f, agentTree_[agentTree_[node].left].minCoord[1] - position.y())) + sqr(std::max(0.0f, position.y() - agentTree_[agentTree_[node].left].maxCoord[1])) + sqr(std::max(0.0f, agentTree_[agentTree_[node].left].minCoord[2] - position.z())) + sqr(std::max(0.0f, position.z() - agentTree_[agentTree_[node].left].maxCoord[2]));
 
-			const float distSqRight = sqr(std::max(0.0f, agentTree_[agentTree_[node].right].minCoord[0] - agent->position_.x())) + sqr(std::max(0.0f, agent->position_.x() - agentTree_[agentTree_[node].right].maxCoord[0])) + sqr(std::max(0.0f, agentTree_[agentTree_[node].right].minCoord[1] - agent->position_.y())) + sqr(std::max(0.0f, agent->position_.y() - agentTree_[agentTree_[node].right].maxCoord[1])) + sqr(std::max(0.0f, agentTree_[agentTree_[node].right].minCoord[2] - agent->position_.z())) + sqr(std::max(0.0f, agent->position_.z() - agentTree_[agentTree_[node].right].maxCoord[2]));
+			const float distSqRight = sqr(std::max(0.0f, agentTree_[agentTree_[node].right].minCoord[0] - position.x())) + sqr(std::max(0.0f, position.x() - agentTree_[agentTree_[node].right].maxCoord[0])) + sqr(std::max(0.0f, agentTree_[agentTree_[node].right].minCoord[1] - position.y())) + sqr(std::max(0.0f, position.y() - agentTree_[agentTree_[node].right].maxCoord[1])) + sqr(std::max(0.0f, agentTree_[agentTree_[node].right].minCoord[2] - position.z())) + sqr(std::max(0.0f, position.z() - agentTree_[agentTree_[node].right].maxCoord[2]));
 
 			if (distSqLeft < distSqRight) {
 				if (distSqLeft < rangeSq) {
-					queryAgentTreeRecursive(agent, rangeSq, agentTree_[node].left);
+					queryAgentTreeRecursive(solver, position, rangeSq, agentTree_[node].left);
 
 					if (distSqRight < rangeSq) {
-						queryAgentTreeRecursive(agent, rangeSq, agentTree_[node].right);
+						queryAgentTreeRecursive(solver, position, rangeSq, agentTree_[node].right);
 					}
 				}
 			}
 			else {
 				if (distSqRight < rangeSq) {
-					queryAgentTreeRecursive(agent, rangeSq, agentTree_[node].right);
+					queryAgentTreeRecursive(solver, position, rangeSq, agentTree_[node].right);
 
 					if (distSqLeft < rangeSq) {
-						queryAgentTreeRecursive(agent, rangeSq, agentTree_[node].left);
+						queryAgentTreeRecursive(solver, position, rangeSq, agentTree_[node].left);
 					}
 				}
 			}
 		}
 	}
+
+	void KdTree::computeSleepingAgents(AgentSolver *solver, const Vector3 &position, float rangeSq) const
+	{
+		if (!agentTree_.empty()) {
+			querySleepingAgentsRecursive(solver, position, rangeSq, 0);
+		}
+	}
+
+	void KdTree::querySleepingAgentsRecursive(AgentSolver *solver, const Vector3 &position, float rangeSq, size_t node) const
+	{
+		const AgentTreeNode &treeNode = agentTree_[node];
+
+		const float distSq = sqr(std::max(0.0f, treeNode.minCoord[0] - position.x())) + sqr(std::max(0.0f, position.x() - treeNode.maxCoord[0])) + sqr(std::max(0.0f, treeNode.minCoord[1] - position.y())) + sqr(std::max(0.0f, position.y() - treeNode.maxCoord[1])) + sqr(std::max(0.0f, treeNode.minCoord[2] - position.z())) + sqr(std::max(0.0f, position.z() - treeNode.maxCoord[2]));
+
+		if (distSq >= rangeSq) {
+			return;
+		}
+
+		if (treeNode.end - treeNode.begin <= RVO_MAX_LEAF_SIZE) {
+			for (size_t i = treeNode.begin; i < treeNode.end; ++i) {
+				if (sim_->asleep_[agents_[i]] && absSq(positions_[i] - position) < rangeSq) {
+					solver->wakeAgents_.push_back(agents_[i]);
+				}
+			}
+		}
+		else {
+			querySleepingAgentsRecursive(solver, position, rangeSq, treeNode.left);
+			querySleepingAgentsRecursive(solver, position, rangeSq, treeNode.right);
+		}
+	}
 }
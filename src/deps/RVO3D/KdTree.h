@@ -39,12 +39,13 @@
 #include "API.h"
 
 #include <cstddef>
+#include <functional>
 #include <vector>
 
 #include "Vector3.h"
 
 namespace RVO {
-	class Agent;
+	class AgentSolver;
 	class RVOSimulator;
 
 	/**
@@ -77,6 +78,11 @@ namespace RVO {
 			 */
 			size_t right;
 
+			/**
+			 * \brief   The coordinate the node is split along.
+			 */
+			size_t coord;
+
 			/**
 			 * \brief   The maximum coordinates.
 			 */
@@ -88,6 +94,42 @@ namespace RVO {
 			Vector3 minCoord;
 		};
 
+		/**
+		 * \brief   Defines a node of the bounding volume hierarchy of static obstacles.
+		 */
+		class ObstacleTreeNode {
+		public:
+			/**
+			 * \brief   The beginning obstacle number, in tree order.
+			 */
+			size_t begin;
+
+			/**
+			 * \brief   The ending obstacle number, in tree order.
+			 */
+			size_t end;
+
+			/**
+			 * \brief   The left node number, or zero for leaves.
+			 */
+			size_t left;
+
+			/**
+			 * \brief   The right node number, or zero for leaves.
+			 */
+			size_t right;
+
+			/**
+			 * \brief   The maximum coordinates of the obstacles.
+			 */
+			Vector3 maxCoord;
+
+			/**
+			 * \brief   The minimum coordinates of the obstacles.
+			 */
+			Vector3 minCoord;
+		};
+
 		/**
 		 * \brief   Constructs a <i>k</i>d-tree instance.
 		 * \param   sim  The simulator instance.
@@ -95,26 +137,107 @@ namespace RVO {
 		explicit KdTree(RVOSimulator *sim);
 
 		/**
-		 * \brief   Builds an agent <i>k</i>d-tree.
+		 * \brief   Builds an agent <i>k</i>d-tree, or refits the last one.
+		 *
+		 * While the number of agents stays the same, the last tree is kept and only its bounds are updated to the new positions. It is rebuilt once the children of its nodes overlap too much, because agents crossed the split planes.
 		 */
 		void buildAgentTree();
 
-		void buildAgentTreeRecursive(size_t begin, size_t end, size_t node);
+		/**
+		 * \brief   Builds a node and its descendants.
+		 * \param   begin  The beginning agent number, in tree order.
+		 * \param   end    The ending agent number, in tree order.
+		 * \param   node   The node number.
+		 * \param   depth  The depth below which subtrees are left to separate tasks; their nodes are added to subtrees_ with only begin and end set.
+		 */
+		void buildAgentTreeRecursive(size_t begin, size_t end, size_t node, size_t depth);
+
+		/**
+		 * \brief   Updates the bounds of a node and its descendants.
+		 * \param   node     The node number.
+		 * \param   depth    The depth below which subtrees are left to separate tasks.
+		 * \param   overlap  Incremented by how far the children of internal nodes overlap along their split coordinate.
+		 * \param   extent   Incremented by the extent of internal nodes along their split coordinate.
+		 */
+		void refitAgentTreeRecursive(size_t node, size_t depth, float &overlap, float &extent);
+
+		/**
+		 * \brief   Adds the nodes at the specified depth below a node to subtrees_.
+		 */
+		void collectSubtrees(size_t node, size_t depth);
+
+		/**
+		 * \brief   Runs a task for each element of subtrees_, in parallel if the tree is large enough.
+		 */
+		void runSubtreeTasks(const std::function<void(size_t)> &task);
+
+		/**
+		 * \brief   Computes the agent neighbors of the current agent of a solver.
+		 * \param   solver    The solver whose current agent the neighbors are to be computed for.
+		 * \param   position  The position of the agent.
+		 * \param   rangeSq   The squared range around the agent.
+		 */
+		void computeAgentNeighbors(AgentSolver *solver, const Vector3 &position, float rangeSq) const;
+
+		void queryAgentTreeRecursive(AgentSolver *solver, const Vector3 &position, float &rangeSq, size_t node) const;
+
+		/**
+		 * \brief   Adds all sleeping agents near a position to the agents a solver wakes, however many there are.
+		 * \param   solver    The solver that is to wake the agents.
+		 * \param   position  The position of the moving agent.
+		 * \param   rangeSq   The squared range around the position.
+		 */
+		void computeSleepingAgents(AgentSolver *solver, const Vector3 &position, float rangeSq) const;
+
+		void querySleepingAgentsRecursive(AgentSolver *solver, const Vector3 &position, float rangeSq, size_t node) const;
 
 		/**
-		 * \brief   Computes the agent neighbors of the specified agent.
-		 * \param   agent    A pointer to the agent for which agent neighbors are to be computed.
-		 * \param   rangeSq  The squared range around the agent.
+		 * \brief   Builds the bounding volume hierarchy of the static obstacles.
 		 */
-		void computeAgentNeighbors(Agent *agent, float rangeSq) const;
+		void buildObstacleTree();
 
-		void queryAgentTreeRecursive(Agent *agent, float &rangeSq, size_t node) const;
+		size_t buildObstacleTreeRecursive(size_t begin, size_t end);
+
+		/**
+		 * \brief   Computes the static obstacles near the current agent of a solver.
+		 * \param   solver    The solver whose current agent the obstacles are to be computed for.
+		 * \param   position  The position of the agent.
+		 * \param   range     The distance from the agent within which the surface of an obstacle has to be.
+		 */
+		void computeObstacleNeighbors(AgentSolver *solver, const Vector3 &position, float range) const;
+
+		void queryObstacleTreeRecursive(AgentSolver *solver, const Vector3 &position, float range, size_t node) const;
+
+		/**
+		 * \brief   The numbers of the agents, in tree order.
+		 */
+		std::vector<size_t> agents_;
+
+		/**
+		 * \brief   The positions of the agents, in tree order.
+		 */
+		std::vector<Vector3> positions_;
 
-		std::vector<Agent *> agents_;
 		std::vector<AgentTreeNode> agentTree_;
+
+		/* The subtrees built or refitted as separate tasks, and how much
+		 * the nodes of each overlap, see refitAgentTreeRecursive(). */
+		std::vector<size_t> subtrees_;
+		std::vector<float> subtreeOverlaps_;
+		std::vector<float> subtreeExtents_;
+
+		/**
+		 * \brief   The numbers, centers and radii of the obstacles, in tree order.
+		 */
+		std::vector<size_t> obstacles_;
+		std::vector<Vector3> obstacleCenters_;
+		std::vector<float> obstacleRadii_;
+
+		std::vector<ObstacleTreeNode> obstacleTree_;
+
 		RVOSimulator *sim_;
 
-		friend class Agent;
+		friend class AgentSolver;
 		friend class RVOSimulator;
 	};
 }
@@ -32,30 +32,35 @@
 
 #include "RVOSimulator.h"
 
-#ifdef _OPENMP
-#include <omp.h>
-#endif
+#include <algorithm>
+#include <cassert>
 
 #include "Agent.h"
+#include "Definitions.h"
 #include "KdTree.h"
+#include "TaskPool.h"
 
 namespace RVO {
-	RVOSimulator::RVOSimulator() : defaultAgent_(NULL), kdTree_(NULL), globalTime_(0.0f), timeStep_(0.0f)
+	const size_t RVO_AGENT_SLOT_MASK = (static_cast<size_t>(1) << RVO_AGENT_SLOT_BITS) - 1;
+	const size_t RVO_AGENT_GENERATION_MASK = RVO_ERROR >> RVO_AGENT_SLOT_BITS;
+
+	/**
+	 * \brief   The number of agents in a chunk of the loops of a step.
+	 */
+	const size_t RVO_VELOCITY_CHUNK_SIZE = 64;
+	const size_t RVO_UPDATE_CHUNK_SIZE = 1024;
+
+	RVOSimulator::RVOSimulator() : defaultAgent_(NULL), kdTree_(NULL), taskPool_(NULL), globalTime_(0.0f), timeStep_(0.0f), numVelocityGroups_(1), velocityGroup_(0), planarTolerance_(-1.0f), obstaclesChanged_(false)
 	{
 		kdTree_ = new KdTree(this);
+		setNumThreads(1);
 	}
 
-	RVOSimulator::RVOSimulator(float timeStep, float neighborDist, size_t maxNeighbors, float timeHorizon, float radius, float maxSpeed, const Vector3 &velocity) : defaultAgent_(NULL), kdTree_(NULL), globalTime_(0.0f), timeStep_(timeStep)
+	RVOSimulator::RVOSimulator(float timeStep, float neighborDist, size_t maxNeighbors, float timeHorizon, float radius, float maxSpeed, const Vector3 &velocity) : defaultAgent_(NULL), kdTree_(NULL), taskPool_(NULL), globalTime_(0.0f), timeStep_(timeStep), numVelocityGroups_(1), velocityGroup_(0), planarTolerance_(-1.0f), obstaclesChanged_(false)
 	{
 		kdTree_ = new KdTree(this);
-		defaultAgent_ = new Agent(this);
-
-		defaultAgent_->maxNeighbors_ = maxNeighbors;
-		defaultAgent_->maxSpeed_ = maxSpeed;
-		defaultAgent_->neighborDist_ = neighborDist;
-		defaultAgent_->radius_ = radius;
-		defaultAgent_->timeHorizon_ = timeHorizon;
-		defaultAgent_->velocity_ = velocity;
+		setNumThreads(1);
+		setAgentDefaults(neighborDist, maxNeighbors, timeHorizon, radius, maxSpeed, velocity);
 	}
 
 	RVOSimulator::~RVOSimulator()
@@ -64,144 +69,340 @@ namespace RVO {
 			delete defaultAgent_;
 		}
 
-		for (size_t i = 0; i < agents_.size(); ++i) {
-			delete agents_[i];
+		for (size_t i = 0; i < solvers_.size(); ++i) {
+			delete solvers_[i];
 		}
 
 		if (kdTree_ != NULL) {
 			delete kdTree_;
 		}
-	}
 
-	size_t RVOSimulator::getAgentNumAgentNeighbors(size_t agentNo) const
-	{
-		return agents_[agentNo]->agentNeighbors_.size();
+		if (taskPool_ != NULL) {
+			delete taskPool_;
+		}
 	}
 
-	size_t RVOSimulator::getAgentAgentNeighbor(size_t agentNo, size_t neighborNo) const
+	void RVOSimulator::removeAgent(size_t agentNo)
 	{
-		return agents_[agentNo]->agentNeighbors_[neighborNo].second->id_;
+		const size_t index = agentIndex(agentNo);
+		const size_t last = positions_.size() - 1;
+
+		agentNumbers_[index] = agentNumbers_[last];
+		positions_[index] = positions_[last];
+		velocities_[index] = velocities_[last];
+		prefVelocities_[index] = prefVelocities_[last];
+		newVelocities_[index] = newVelocities_[last];
+		radii_[index] = radii_[last];
+		maxSpeeds_[index] = maxSpeeds_[last];
+		neighborDists_[index] = neighborDists_[last];
+		timeHorizons_[index] = timeHorizons_[last];
+		maxNeighbors_[index] = maxNeighbors_[last];
+		avoidance_[index] = avoidance_[last];
+		groups_[index] = groups_[last];
+		asleep_[index] = asleep_[last];
+		canSleep_[index] = canSleep_[last];
+		neighborLists_[index].swap(neighborLists_[last]);
+		hasNeighborList_[index] = hasNeighborList_[last];
+
+		agentNumbers_.pop_back();
+		positions_.pop_back();
+		velocities_.pop_back();
+		prefVelocities_.pop_back();
+		newVelocities_.pop_back();
+		radii_.pop_back();
+		maxSpeeds_.pop_back();
+		neighborDists_.pop_back();
+		timeHorizons_.pop_back();
+		maxNeighbors_.pop_back();
+		avoidance_.pop_back();
+		groups_.pop_back();
+		asleep_.pop_back();
+		canSleep_.pop_back();
+		neighborLists_.pop_back();
+		hasNeighborList_.pop_back();
+
+		const size_t slot = agentNo & RVO_AGENT_SLOT_MASK;
+
+		if (index != last) {
+			slotAgents_[agentNumbers_[index] & RVO_AGENT_SLOT_MASK] = index;
+		}
+
+		slotAgents_[slot] = RVO_ERROR;
+		slotGenerations_[slot] = (slotGenerations_[slot] + 1) & RVO_AGENT_GENERATION_MASK;
+		freeSlots_.push_back(slot);
 	}
 
-	size_t RVOSimulator::getAgentNumORCAPlanes(size_t agentNo) const
+	size_t RVOSimulator::addAgent(const Vector3 &position)
 	{
-		return agents_[agentNo]->orcaPlanes_.size();
+		if (defaultAgent_ == NULL) {
+			return RVO_ERROR;
+		}
+
+		return addAgent(position, defaultAgent_->neighborDist, defaultAgent_->maxNeighbors, defaultAgent_->timeHorizon, defaultAgent_->radius, defaultAgent_->maxSpeed, defaultAgent_->velocity);
 	}
 
-	const Plane &RVOSimulator::getAgentORCAPlane(size_t agentNo, size_t planeNo) const
+	size_t RVOSimulator::addAgent(const Vector3 &position, float neighborDist, size_t maxNeighbors, float timeHorizon, float radius, float maxSpeed, const Vector3 &velocity)
 	{
-		return agents_[agentNo]->orcaPlanes_[planeNo];
+		size_t slot;
+
+		if (!freeSlots_.empty()) {
+			slot = freeSlots_.back();
+			freeSlots_.pop_back();
+		}
+		else {
+			/* The all ones slot would make RVO_ERROR a valid number. */
+			assert(slotAgents_.size() < RVO_AGENT_SLOT_MASK);
+			slot = slotAgents_.size();
+			slotAgents_.push_back(RVO_ERROR);
+			slotGenerations_.push_back(0);
+		}
+
+		const size_t agentNo = (slotGenerations_[slot] << RVO_AGENT_SLOT_BITS) | slot;
+		slotAgents_[slot] = positions_.size();
+
+		agentNumbers_.push_back(agentNo);
+		positions_.push_back(position);
+		velocities_.push_back(velocity);
+		prefVelocities_.push_back(Vector3());
+		newVelocities_.push_back(Vector3());
+		radii_.push_back(radius);
+		maxSpeeds_.push_back(maxSpeed);
+		neighborDists_.push_back(neighborDist);
+		timeHorizons_.push_back(timeHorizon);
+		maxNeighbors_.push_back(maxNeighbors);
+		avoidance_.push_back(1);
+		groups_.push_back(RVO_NO_GROUP);
+		asleep_.push_back(0);
+		canSleep_.push_back(0);
+		neighborLists_.push_back(std::vector<size_t>());
+		hasNeighborList_.push_back(0);
+
+		return agentNo;
 	}
 
-	void RVOSimulator::removeAgent(size_t agentNo)
+	size_t RVOSimulator::agentIndex(size_t agentNo) const
 	{
-		delete agents_[agentNo];
-		agents_[agentNo] = agents_.back();
-		agents_.pop_back();
+		assert(hasAgent(agentNo));
+		return slotAgents_[agentNo & RVO_AGENT_SLOT_MASK];
 	}
 
-	size_t RVOSimulator::addAgent(const Vector3 &position)
+	size_t RVOSimulator::addObstacle(const Vector3 &center, float radius)
 	{
-		if (defaultAgent_ == NULL) {
-			return RVO_ERROR;
-		}
-
-		Agent *agent = new Agent(this);
+		size_t obstacleNo;
 
-		agent->position_ = position;
-		agent->maxNeighbors_ = defaultAgent_->maxNeighbors_;
-		agent->maxSpeed_ = defaultAgent_->maxSpeed_;
-		agent->neighborDist_ = defaultAgent_->neighborDist_;
-		agent->radius_ = defaultAgent_->radius_;
-		agent->timeHorizon_ = defaultAgent_->timeHorizon_;
-		agent->velocity_ = defaultAgent_->velocity_;
-
-		agent->id_ = agents_.size();
+		if (!freeObstacles_.empty()) {
+			obstacleNo = freeObstacles_.back();
+			freeObstacles_.pop_back();
+		}
+		else {
+			obstacleNo = obstacleCenters_.size();
+			obstacleCenters_.push_back(Vector3());
+			obstacleRadii_.push_back(0.0f);
+		}
 
-		agents_.push_back(agent);
+		obstacleCenters_[obstacleNo] = center;
+		obstacleRadii_[obstacleNo] = radius;
+		obstaclesChanged_ = true;
 
-		return agents_.size() - 1;
+		return obstacleNo;
 	}
 
-	size_t RVOSimulator::addAgent(const Vector3 &position, float neighborDist, size_t maxNeighbors, float timeHorizon, float radius, float maxSpeed, const Vector3 &velocity)
+	void RVOSimulator::removeObstacle(size_t obstacleNo)
 	{
-		Agent *agent = new Agent(this);
-
-		agent->position_ = position;
-		agent->maxNeighbors_ = maxNeighbors;
-		agent->maxSpeed_ = maxSpeed;
-		agent->neighborDist_ = neighborDist;
-		agent->radius_ = radius;
-		agent->timeHorizon_ = timeHorizon;
-		agent->velocity_ = velocity;
+		assert(obstacleRadii_[obstacleNo] >= 0.0f);
 
-		agent->id_ = agents_.size();
+		obstacleRadii_[obstacleNo] = -1.0f;
+		freeObstacles_.push_back(obstacleNo);
+		obstaclesChanged_ = true;
+	}
 
-		agents_.push_back(agent);
+	void RVOSimulator::clearAgentNeighbors(size_t agentNo)
+	{
+		const size_t index = agentIndex(agentNo);
 
-		return agents_.size() - 1;
+		neighborLists_[index].clear();
+		hasNeighborList_[index] = 0;
 	}
 
 	void RVOSimulator::doStep()
 	{
-		kdTree_->buildAgentTree();
+		if (obstaclesChanged_) {
+			kdTree_->buildObstacleTree();
+			obstaclesChanged_ = false;
+		}
+
+		/* The kd-tree is only needed by agents that search for their own
+		 * neighbors, and to find the sleeping agents near agents that
+		 * don't avoid them. A tree that is skipped is refitted or rebuilt
+		 * from scratch by the next step that needs it. */
+		bool searching = false;
+		bool sleeping = false;
+		bool passing = false;
+
+		for (size_t i = 0; i < positions_.size(); ++i) {
+			if (asleep_[i]) {
+				sleeping = true;
+			}
+			else if (avoidance_[i]) {
+				searching = searching || (!hasNeighborList_[i] && maxNeighbors_[i] > 0);
+			}
+			else {
+				passing = passing || absSq(velocities_[i]) > sqr(RVO_SLEEP_SPEED) || absSq(prefVelocities_[i]) > sqr(RVO_SLEEP_SPEED);
+			}
+		}
+
+		const bool wakeSleeping = sleeping && passing;
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-		for (int i = 0; i < static_cast<int>(agents_.size()); ++i) {
-			agents_[i]->computeNeighbors();
-			agents_[i]->computeNewVelocity();
+		if (searching || wakeSleeping) {
+			kdTree_->buildAgentTree();
 		}
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-		for (int i = 0; i < static_cast<int>(agents_.size()); ++i) {
-			agents_[i]->update();
+		for (size_t i = 0; i < solvers_.size(); ++i) {
+			solvers_[i]->numNoNeighbors_ = 0;
+			solvers_[i]->numUnconstrained_ = 0;
+			solvers_[i]->numLinearProgram3_ = 0;
+			solvers_[i]->numLinearProgram4_ = 0;
+			solvers_[i]->numPlanar_ = 0;
+			solvers_[i]->numAsleep_ = 0;
+			solvers_[i]->wakeAgents_.clear();
+		}
+
+		const size_t numAgents = positions_.size();
+		const size_t numGroupAgents = (numAgents + numVelocityGroups_ - 1 - velocityGroup_) / numVelocityGroups_;
+
+		taskPool_->parallelFor(numGroupAgents, RVO_VELOCITY_CHUNK_SIZE, [this, wakeSleeping](size_t thread, size_t begin, size_t end) {
+			AgentSolver *solver = solvers_[thread];
+
+			for (size_t k = begin; k < end; ++k) {
+				const size_t i = velocityGroup_ + k * numVelocityGroups_;
+
+				if (avoidance_[i]) {
+					if (asleep_[i]) {
+						++solver->numAsleep_;
+					}
+					else {
+						solver->computeNeighbors(i);
+						solver->computeNewVelocity();
+						canSleep_[i] = solver->canSleep();
+					}
+				}
+				else {
+					newVelocities_[i] = prefVelocities_[i];
+
+					if (wakeSleeping) {
+						solver->wakeNeighbors(i);
+					}
+				}
+			}
+		});
+
+		taskPool_->parallelFor(numAgents, RVO_UPDATE_CHUNK_SIZE, [this](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				if (canSleep_[i]) {
+					asleep_[i] = 1;
+					canSleep_[i] = 0;
+				}
+
+				if (asleep_[i]) {
+					velocities_[i] = Vector3();
+				}
+				else {
+					velocities_[i] = newVelocities_[i];
+					positions_[i] += velocities_[i] * timeStep_;
+				}
+			}
+		});
+
+		for (size_t i = 0; i < solvers_.size(); ++i) {
+			for (size_t j = 0; j < solvers_[i]->wakeAgents_.size(); ++j) {
+				asleep_[solvers_[i]->wakeAgents_[j]] = 0;
+			}
 		}
 
 		globalTime_ += timeStep_;
+		velocityGroup_ = (velocityGroup_ + 1) % numVelocityGroups_;
+	}
+
+	bool RVOSimulator::getAgentAvoidance(size_t agentNo) const
+	{
+		return avoidance_[agentIndex(agentNo)] != 0;
+	}
+
+	size_t RVOSimulator::getAgentGroup(size_t agentNo) const
+	{
+		return groups_[agentIndex(agentNo)];
+	}
+
+	bool RVOSimulator::hasAgent(size_t agentNo) const
+	{
+		const size_t slot = agentNo & RVO_AGENT_SLOT_MASK;
+
+		return slot < slotAgents_.size() && slotAgents_[slot] != RVO_ERROR && slotGenerations_[slot] == agentNo >> RVO_AGENT_SLOT_BITS;
+	}
+
+	bool RVOSimulator::isAgentAsleep(size_t agentNo) const
+	{
+		return asleep_[agentIndex(agentNo)] != 0;
 	}
 
 	size_t RVOSimulator::getAgentMaxNeighbors(size_t agentNo) const
 	{
-		return agents_[agentNo]->maxNeighbors_;
+		return maxNeighbors_[agentIndex(agentNo)];
 	}
 
 	float RVOSimulator::getAgentMaxSpeed(size_t agentNo) const
 	{
-		return agents_[agentNo]->maxSpeed_;
+		return maxSpeeds_[agentIndex(agentNo)];
 	}
 
 	float RVOSimulator::getAgentNeighborDist(size_t agentNo) const
 	{
-		return agents_[agentNo]->neighborDist_;
+		return neighborDists_[agentIndex(agentNo)];
 	}
 
 	const Vector3 &RVOSimulator::getAgentPosition(size_t agentNo) const
 	{
-		return agents_[agentNo]->position_;
+		return positions_[agentIndex(agentNo)];
 	}
 
 	const Vector3 &RVOSimulator::getAgentPrefVelocity(size_t agentNo) const
 	{
-		return agents_[agentNo]->prefVelocity_;
+		return prefVelocities_[agentIndex(agentNo)];
+	}
+
+	void RVOSimulator::getAgentPositions(const size_t *agentNos, size_t count, float *xyz) const
+	{
+		for (size_t i = 0; i < count; ++i) {
+			const Vector3 &position = positions_[agentIndex(agentNos[i])];
+			xyz[3 * i] = position.x();
+			xyz[3 * i + 1] = position.y();
+			xyz[3 * i + 2] = position.z();
+		}
 	}
 
 	float RVOSimulator::getAgentRadius(size_t agentNo) const
 	{
-		return agents_[agentNo]->radius_;
+		return radii_[agentIndex(agentNo)];
 	}
 
 	float RVOSimulator::getAgentTimeHorizon(size_t agentNo) const
 	{
-		return agents_[agentNo]->timeHorizon_;
+		return timeHorizons_[agentIndex(agentNo)];
 	}
 
 	const Vector3 &RVOSimulator::getAgentVelocity(size_t agentNo) const
 	{
-		return agents_[agentNo]->velocity_;
+		return velocities_[agentIndex(agentNo)];
+	}
+
+	void RVOSimulator::getAgentVelocities(const size_t *agentNos, size_t count, float *xyz) const
+	{
+		for (size_t i = 0; i < count; ++i) {
+			const Vector3 &velocity = velocities_[agentIndex(agentNos[i])];
+			xyz[3 * i] = velocity.x();
+			xyz[3 * i + 1] = velocity.y();
+			xyz[3 * i + 2] = velocity.z();
+		}
 	}
 
 	float RVOSimulator::getGlobalTime() const
@@ -211,7 +412,48 @@ namespace RVO {
 
 	size_t RVOSimulator::getNumAgents() const
 	{
-		return agents_.size();
+		return positions_.size();
+	}
+
+	size_t RVOSimulator::getNumObstacles() const
+	{
+		return obstacleCenters_.size() - freeObstacles_.size();
+	}
+
+	size_t RVOSimulator::getNumSleepingAgents() const
+	{
+		return static_cast<size_t>(std::count(asleep_.begin(), asleep_.end(), 1));
+	}
+
+	size_t RVOSimulator::getNumVelocityGroups() const
+	{
+		return numVelocityGroups_;
+	}
+
+	size_t RVOSimulator::getNumThreads() const
+	{
+		return taskPool_->getNumThreads();
+	}
+
+	float RVOSimulator::getPlanarTolerance() const
+	{
+		return planarTolerance_;
+	}
+
+	SolverStats RVOSimulator::getSolverStats() const
+	{
+		SolverStats stats = { 0, 0, 0, 0, 0, 0 };
+
+		for (size_t i = 0; i < solvers_.size(); ++i) {
+			stats.noNeighbors += solvers_[i]->numNoNeighbors_;
+			stats.unconstrained += solvers_[i]->numUnconstrained_;
+			stats.linearProgram3 += solvers_[i]->numLinearProgram3_;
+			stats.linearProgram4 += solvers_[i]->numLinearProgram4_;
+			stats.planar += solvers_[i]->numPlanar_;
+			stats.asleep += solvers_[i]->numAsleep_;
+		}
+
+		return stats;
 	}
 
 	float RVOSimulator::getTimeStep() const
@@ -222,55 +464,128 @@ namespace RVO {
 	void RVOSimulator::setAgentDefaults(float neighborDist, size_t maxNeighbors, float timeHorizon, float radius, float maxSpeed, const Vector3 &velocity)
 	{
 		if (defaultAgent_ == NULL) {
-			defaultAgent_ = new Agent(this);
+			defaultAgent_ = new AgentDefaults();
 		}
 
-		defaultAgent_->maxNeighbors_ = maxNeighbors;
-		defaultAgent_->maxSpeed_ = maxSpeed;
-		defaultAgent_->neighborDist_ = neighborDist;
-		defaultAgent_->radius_ = radius;
-		defaultAgent_->timeHorizon_ = timeHorizon;
-		defaultAgent_->velocity_ = velocity;
+		defaultAgent_->maxNeighbors = maxNeighbors;
+		defaultAgent_->maxSpeed = maxSpeed;
+		defaultAgent_->neighborDist = neighborDist;
+		defaultAgent_->radius = radius;
+		defaultAgent_->timeHorizon = timeHorizon;
+		defaultAgent_->velocity = velocity;
+	}
+
+	void RVOSimulator::setAgentAvoidance(size_t agentNo, bool avoidance)
+	{
+		const size_t index = agentIndex(agentNo);
+
+		avoidance_[index] = avoidance;
+		asleep_[index] = 0;
+	}
+
+	void RVOSimulator::setAgentGroup(size_t agentNo, size_t group)
+	{
+		groups_[agentIndex(agentNo)] = group;
 	}
 
 	void RVOSimulator::setAgentMaxNeighbors(size_t agentNo, size_t maxNeighbors)
 	{
-		agents_[agentNo]->maxNeighbors_ = maxNeighbors;
+		maxNeighbors_[agentIndex(agentNo)] = maxNeighbors;
+	}
+
+	void RVOSimulator::setAgentNeighbors(size_t agentNo, const size_t *neighborNos, size_t count)
+	{
+		const size_t index = agentIndex(agentNo);
+
+		neighborLists_[index].assign(neighborNos, neighborNos + count);
+		hasNeighborList_[index] = 1;
 	}
 
 	void RVOSimulator::setAgentMaxSpeed(size_t agentNo, float maxSpeed)
 	{
-		agents_[agentNo]->maxSpeed_ = maxSpeed;
+		maxSpeeds_[agentIndex(agentNo)] = maxSpeed;
 	}
 
 	void RVOSimulator::setAgentNeighborDist(size_t agentNo, float neighborDist)
 	{
-		agents_[agentNo]->neighborDist_ = neighborDist;
+		neighborDists_[agentIndex(agentNo)] = neighborDist;
 	}
 
 	void RVOSimulator::setAgentPosition(size_t agentNo, const Vector3 &position)
 	{
-		agents_[agentNo]->position_ = position;
+		const size_t index = agentIndex(agentNo);
+
+		positions_[index] = position;
+		asleep_[index] = 0;
 	}
 
 	void RVOSimulator::setAgentPrefVelocity(size_t agentNo, const Vector3 &prefVelocity)
 	{
-		agents_[agentNo]->prefVelocity_ = prefVelocity;
+		const size_t index = agentIndex(agentNo);
+
+		prefVelocities_[index] = prefVelocity;
+
+		if (absSq(prefVelocity) > sqr(RVO_SLEEP_SPEED)) {
+			asleep_[index] = 0;
+		}
+	}
+
+	void RVOSimulator::setAgentPrefVelocities(const size_t *agentNos, size_t count, const float *xyz)
+	{
+		for (size_t i = 0; i < count; ++i) {
+			const size_t index = agentIndex(agentNos[i]);
+
+			prefVelocities_[index] = Vector3(xyz + 3 * i);
+
+			if (absSq(prefVelocities_[index]) > sqr(RVO_SLEEP_SPEED)) {
+				asleep_[index] = 0;
+			}
+		}
 	}
 
 	void RVOSimulator::setAgentRadius(size_t agentNo, float radius)
 	{
-		agents_[agentNo]->radius_ = radius;
+		const size_t index = agentIndex(agentNo);
+
+		radii_[index] = radius;
+		asleep_[index] = 0;
 	}
 
 	void RVOSimulator::setAgentTimeHorizon(size_t agentNo, float timeHorizon)
 	{
-		agents_[agentNo]->timeHorizon_ = timeHorizon;
+		timeHorizons_[agentIndex(agentNo)] = timeHorizon;
 	}
 
 	void RVOSimulator::setAgentVelocity(size_t agentNo, const Vector3 &velocity)
 	{
-		agents_[agentNo]->velocity_ = velocity;
+		const size_t index = agentIndex(agentNo);
+
+		velocities_[index] = velocity;
+		asleep_[index] = 0;
+	}
+
+	void RVOSimulator::setNumVelocityGroups(size_t numVelocityGroups)
+	{
+		numVelocityGroups_ = numVelocityGroups;
+		velocityGroup_ %= numVelocityGroups_;
+	}
+
+	void RVOSimulator::setNumThreads(size_t numThreads)
+	{
+		if (taskPool_ != NULL) {
+			delete taskPool_;
+		}
+
+		taskPool_ = new TaskPool(numThreads);
+
+		while (solvers_.size() < numThreads) {
+			solvers_.push_back(new AgentSolver(this));
+		}
+	}
+
+	void RVOSimulator::setPlanarTolerance(float planarTolerance)
+	{
+		planarTolerance_ = planarTolerance;
 	}
 
 	void RVOSimulator::setTimeStep(float timeStep)
@@ -46,8 +46,9 @@
 #include "Vector3.h"
 
 namespace RVO {
-	class Agent;
+	class AgentSolver;
 	class KdTree;
+	class TaskPool;
 
 	/**
 	 * \brief   Error value.
@@ -56,6 +57,25 @@ namespace RVO {
 	 */
 	const size_t RVO_ERROR = std::numeric_limits<size_t>::max();
 
+	/**
+	 * \brief   The group of agents that are in none, see RVOSimulator::setAgentGroup.
+	 */
+	const size_t RVO_NO_GROUP = 0;
+
+	/**
+	 * \brief   The number of low bits of an agent number that hold its slot.
+	 *
+	 * The bits above hold the generation of the slot, which changes every time an agent in the slot is removed, so that the numbers of removed agents are never valid again until the generation wraps around.
+	 */
+	const size_t RVO_AGENT_SLOT_BITS = 20;
+
+	/**
+	 * \brief   The speed up to which an agent counts as still.
+	 *
+	 * An agent that is still, prefers to be still and has only still neighbors is put to sleep: it is skipped by the simulation steps and doesn't move until it is woken. It wakes when a moving agent takes it as a neighbor or comes within the neighbor distance of it without avoiding collisions, when it is given a preferred velocity faster than this, and when its position, velocity, radius or avoidance is set.
+	 */
+	const float RVO_SLEEP_SPEED = 0.001f;
+
 	/**
 	 * \brief   Defines a plane.
 	 */
@@ -72,10 +92,48 @@ namespace RVO {
 		Vector3 normal;
 	};
 
+	/**
+	 * \brief   Counts of the agents whose new velocity was found each way in a simulation step. Agents with avoidance turned off are not counted.
+	 */
+	class SolverStats {
+	public:
+		/**
+		 * \brief   Agents with no neighbors or obstacles, which took their preferred velocity.
+		 */
+		size_t noNeighbors;
+
+		/**
+		 * \brief   Agents whose preferred velocity satisfied all of their ORCA planes.
+		 */
+		size_t unconstrained;
+
+		/**
+		 * \brief   Agents in conflict whose new velocity was found by the three-dimensional linear program.
+		 */
+		size_t linearProgram3;
+
+		/**
+		 * \brief   Agents whose ORCA planes had no common solution, and went on to the four-dimensional linear program.
+		 */
+		size_t linearProgram4;
+
+		/**
+		 * \brief   Agents of the last three counts that were solved in the plane, see RVOSimulator::setPlanarTolerance.
+		 */
+		size_t planar;
+
+		/**
+		 * \brief   Agents that were asleep, and skipped, see RVO::RVO_SLEEP_SPEED.
+		 */
+		size_t asleep;
+	};
+
 	/**
 	 * \brief  Defines the simulation.
 	 *
 	 * The main class of the library that contains all simulation functionality.
+	 *
+	 * Agents are referred to by the number returned when they were added, which stays valid until they are removed, whatever is added or removed in between. Numbers are handed out from zero up as long as no agent is removed.
 	 */
 	class RVOSimulator {
 	public:
@@ -105,6 +163,7 @@ namespace RVO {
 		 * \brief   Adds a new agent with default properties to the simulation.
 		 * \param   position  The three-dimensional starting position of this agent.
 		 * \return  The number of the agent, or RVO::RVO_ERROR when the agent defaults have not been set.
+		 * \note    Takes constant time, apart from growing the agent arrays.
 		 */
 		RVO_API size_t addAgent(const Vector3 &position);
 
@@ -121,18 +180,53 @@ namespace RVO {
 		 */
 		RVO_API size_t addAgent(const Vector3 &position, float neighborDist, size_t maxNeighbors, float timeHorizon, float radius, float maxSpeed, const Vector3 &velocity = Vector3());
 
+		/**
+		 * \brief   Adds a new static spherical obstacle to the simulation.
+		 * \param   center  The three-dimensional center of the obstacle.
+		 * \param   radius  The radius of the obstacle. Must be non-negative.
+		 * \return  The number of the obstacle.
+		 * \note    Obstacles are kept in a bounding volume hierarchy of their own, which is rebuilt by the next step after obstacles are added or removed, so they are meant for things that rarely change. Agents avoid every obstacle they could reach within their time horizon, taking all of the avoidance on themselves, and obstacles don't count against their maximum neighbor count.
+		 */
+		RVO_API size_t addObstacle(const Vector3 &center, float radius);
+
+		/**
+		 * \brief   Makes a specified agent search for its neighbors again, after setAgentNeighbors.
+		 * \param   agentNo  The number of the agent.
+		 */
+		RVO_API void clearAgentNeighbors(size_t agentNo);
+
 		/**
 		 * \brief   Lets the simulator perform a simulation step and updates the three-dimensional position and three-dimensional velocity of each agent.
 		 */
 		RVO_API void doStep();
 
 		/**
-		 * \brief   Returns the specified agent neighbor of the specified agent.
-		 * \param   agentNo     The number of the agent whose agent neighbor is to be retrieved.
-		 * \param   neighborNo  The number of the agent neighbor to be retrieved.
-		 * \return  The number of the neighboring agent.
+		 * \brief   Returns whether a specified agent avoids other agents.
+		 * \param   agentNo  The number of the agent whose avoidance is to be retrieved.
+		 * \return  Whether the agent avoids other agents.
+		 */
+		RVO_API bool getAgentAvoidance(size_t agentNo) const;
+
+		/**
+		 * \brief   Returns the group of a specified agent, see setAgentGroup.
+		 * \param   agentNo  The number of the agent whose group is to be retrieved.
+		 * \return  The group of the agent, or RVO::RVO_NO_GROUP.
 		 */
-		RVO_API size_t getAgentAgentNeighbor(size_t agentNo, size_t neighborNo) const;
+		RVO_API size_t getAgentGroup(size_t agentNo) const;
+
+		/**
+		 * \brief   Returns whether the specified number refers to an agent in the simulation.
+		 * \param   agentNo  The number to check.
+		 * \return  False if the agent was removed or the number was never handed out.
+		 */
+		RVO_API bool hasAgent(size_t agentNo) const;
+
+		/**
+		 * \brief   Returns whether a specified agent is asleep, see RVO::RVO_SLEEP_SPEED.
+		 * \param   agentNo  The number of the agent.
+		 * \return  True if the agent is asleep.
+		 */
+		RVO_API bool isAgentAsleep(size_t agentNo) const;
 
 		/**
 		 * \brief   Returns the maximum neighbor count of a specified agent.
@@ -155,29 +249,6 @@ namespace RVO {
 		 */
 		RVO_API float getAgentNeighborDist(size_t agentNo) const;
 
-		/**
-		 * \brief   Returns the count of agent neighbors taken into account to compute the current velocity for the specified agent.
-		 * \param   agentNo  The number of the agent whose count of agent neighbors is to be retrieved.
-		 * \return  The count of agent neighbors taken into account to compute the current velocity for the specified agent.
-		 */
-		RVO_API size_t getAgentNumAgentNeighbors(size_t agentNo) const;
-
-		/**
-		 * \brief   Returns the count of ORCA constraints used to compute the current velocity for the specified agent.
-		 * \param   agentNo  The number of the agent whose count of ORCA constraints is to be retrieved.
-		 * \return  The count of ORCA constraints used to compute the current velocity for the specified agent.
-		 */
-		RVO_API size_t getAgentNumORCAPlanes(size_t agentNo) const;
-
-		/**
-		 * \brief   Returns the specified ORCA constraint of the specified agent.
-		 * \param   agentNo  The number of the agent whose ORCA constraint is to be retrieved.
-		 * \param   planeNo  The number of the ORCA constraint to be retrieved.
-		 * \return  A plane representing the specified ORCA constraint.
-		 * \note    The halfspace to which the normal of the plane points is the region of permissible velocities with respect to the specified ORCA constraint.
-		 */
-		RVO_API const Plane &getAgentORCAPlane(size_t agentNo, size_t planeNo) const;
-
 		/**
 		 * \brief   Returns the three-dimensional position of a specified agent.
 		 * \param   agentNo  The number of the agent whose three-dimensional position is to be retrieved.
@@ -185,6 +256,14 @@ namespace RVO {
 		 */
 		RVO_API const Vector3 &getAgentPosition(size_t agentNo) const;
 
+		/**
+		 * \brief   Returns the three-dimensional positions of several agents at once.
+		 * \param   agentNos  The numbers of the agents.
+		 * \param   count     The number of agents.
+		 * \param   xyz       Receives the xyz-coordinates of the position of each agent, three floats per agent, in the order of agentNos.
+		 */
+		RVO_API void getAgentPositions(const size_t *agentNos, size_t count, float *xyz) const;
+
 		/**
 		 * \brief   Returns the three-dimensional preferred velocity of a specified agent.
 		 * \param   agentNo  The number of the agent whose three-dimensional preferred velocity is to be retrieved.
@@ -213,6 +292,14 @@ namespace RVO {
 		 */
 		RVO_API const Vector3 &getAgentVelocity(size_t agentNo) const;
 
+		/**
+		 * \brief   Returns the three-dimensional linear velocities of several agents at once.
+		 * \param   agentNos  The numbers of the agents.
+		 * \param   count     The number of agents.
+		 * \param   xyz       Receives the xyz-coordinates of the velocity of each agent, three floats per agent, in the order of agentNos.
+		 */
+		RVO_API void getAgentVelocities(const size_t *agentNos, size_t count, float *xyz) const;
+
 		/**
 		 * \brief   Returns the global time of the simulation.
 		 * \return  The present global time of the simulation (zero initially).
@@ -225,6 +312,43 @@ namespace RVO {
 		 */
 		RVO_API size_t getNumAgents() const;
 
+		/**
+		 * \brief   Returns the count of static obstacles in the simulation.
+		 * \return  The count of static obstacles in the simulation.
+		 */
+		RVO_API size_t getNumObstacles() const;
+
+		/**
+		 * \brief   Returns the count of agents that are asleep, see RVO::RVO_SLEEP_SPEED. The rest are awake.
+		 * \return  The count of agents that are asleep.
+		 */
+		RVO_API size_t getNumSleepingAgents() const;
+
+		/**
+		 * \brief   Returns the number of groups the agents are split into for
+		 *          computing new velocities.
+		 * \return  The present number of velocity groups.
+		 */
+		RVO_API size_t getNumVelocityGroups() const;
+
+		/**
+		 * \brief   Returns the number of threads a simulation step runs on.
+		 * \return  The present number of threads, including the calling thread.
+		 */
+		RVO_API size_t getNumThreads() const;
+
+		/**
+		 * \brief   Returns how far along z the neighbors of an agent may be for it to be solved in the plane.
+		 * \return  The present planar tolerance, negative if no agent is solved in the plane.
+		 */
+		RVO_API float getPlanarTolerance() const;
+
+		/**
+		 * \brief   Returns how the new velocities of the agents were found in the last simulation step.
+		 * \return  The counts of agents by the way their new velocity was found.
+		 */
+		RVO_API SolverStats getSolverStats() const;
+
 		/**
 		 * \brief   Returns the time step of the simulation.
 		 * \return  The present time step of the simulation.
@@ -234,10 +358,17 @@ namespace RVO {
 		/**
 		 * \brief   Removes an agent from the simulation.
 		 * \param   agentNo  The number of the agent that is to be removed.
-		 * \note    After the removal of the agent, the agent that previously had number getNumAgents() - 1 will now have number agentNo.
+		 * \note    Takes constant time. The numbers of the other agents stay the same.
 		 */
 		RVO_API void removeAgent(size_t agentNo);
 
+		/**
+		 * \brief   Removes a static obstacle from the simulation.
+		 * \param   obstacleNo  The number of the obstacle that is to be removed.
+		 * \note    The numbers of the other obstacles stay the same; this one may be handed out again.
+		 */
+		RVO_API void removeObstacle(size_t obstacleNo);
+
 		/**
 		 * \brief   Sets the default properties for any new agent that is added.
 		 * \param   neighborDist  The default maximum distance (center point to center point) to other agents a new agent takes into account in the navigation. The larger this number, the longer he running time of the simulation. If the number is too low, the simulation will not be safe. Must be non-negative.
@@ -256,6 +387,32 @@ namespace RVO {
 		 */
 		RVO_API void setAgentMaxNeighbors(size_t agentNo, size_t maxNeighbors);
 
+		/**
+		 * \brief   Sets the agents a specified agent considers as its neighbors, in place of searching for them.
+		 * \param   agentNo      The number of the agent.
+		 * \param   neighborNos  The numbers of the candidate neighbors, each at most once. Numbers of agents that have been removed since are skipped.
+		 * \param   count        The number of candidate neighbors.
+		 * \note    Of the candidates, the agent still only takes the maximum neighbor count closest within its neighbor distance into account, at their positions at the time of each step. The candidates are kept until they are set again, or until clearAgentNeighbors. While every awake agent that avoids others has candidates, the steps don't build the kd-tree of the agents at all.
+		 */
+		RVO_API void setAgentNeighbors(size_t agentNo, const size_t *neighborNos, size_t count);
+
+		/**
+		 * \brief   Sets whether a specified agent avoids other agents. An agent
+		 *          without avoidance skips the neighbor search and linear
+		 *          programs and moves at its preferred velocity; other agents
+		 *          still avoid it.
+		 * \param   agentNo    The number of the agent whose avoidance is to be modified.
+		 * \param   avoidance  Whether the agent avoids other agents (the default).
+		 */
+		RVO_API void setAgentAvoidance(size_t agentNo, bool avoidance);
+
+		/**
+		 * \brief   Sets the group of a specified agent. Agents in the same group are not neighbors of each other, e.g. an agent standing in for several others that move with it.
+		 * \param   agentNo  The number of the agent whose group is to be modified.
+		 * \param   group    The group, or RVO::RVO_NO_GROUP (the default) for none.
+		 */
+		RVO_API void setAgentGroup(size_t agentNo, size_t group);
+
 		/**
 		 * \brief   Sets the maximum speed of a specified agent.
 		 * \param   agentNo   The number of the agent whose maximum speed is to be modified.
@@ -284,6 +441,14 @@ namespace RVO {
 		 */
 		RVO_API void setAgentPrefVelocity(size_t agentNo, const Vector3 &prefVelocity);
 
+		/**
+		 * \brief   Sets the three-dimensional preferred velocities of several agents at once.
+		 * \param   agentNos  The numbers of the agents.
+		 * \param   count     The number of agents.
+		 * \param   xyz       The xyz-coordinates of the preferred velocity of each agent, three floats per agent, in the order of agentNos.
+		 */
+		RVO_API void setAgentPrefVelocities(const size_t *agentNos, size_t count, const float *xyz);
+
 		/**
 		 * \brief   Sets the radius of a specified agent.
 		 * \param   agentNo  The number of the agent whose radius is to be modified.
@@ -305,6 +470,34 @@ namespace RVO {
 		 */
 		RVO_API void setAgentVelocity(size_t agentNo, const Vector3 &velocity);
 
+		/**
+		 * \brief   Sets the number of groups the agents are split into for
+		 *          computing new velocities. Each step only the agents of
+		 *          one group, taken in turn, compute new velocities; the
+		 *          others keep moving at their last velocity. All agents
+		 *          move every step.
+		 * \param   numVelocityGroups  The number of velocity groups. Must be
+		 *                             positive; one (the default) updates
+		 *                             every agent every step.
+		 */
+		RVO_API void setNumVelocityGroups(size_t numVelocityGroups);
+
+		/**
+		 * \brief   Sets the number of threads a simulation step runs on. The
+		 *          results are the same for any number of threads.
+		 * \param   numThreads  The number of threads, including the calling
+		 *                      thread. Must be positive; one (the default)
+		 *                      runs the step on the calling thread only.
+		 */
+		RVO_API void setNumThreads(size_t numThreads);
+
+		/**
+		 * \brief   Sets how far along z the neighbors of an agent may be for it to be solved in the plane.
+		 * \param   planarTolerance  The largest gap along z between an agent and any of its neighbors or obstacles, now and at its time horizon, for which the agent is solved with two-dimensional ORCA lines in the xy plane instead of ORCA planes. Negative (the default) solves every agent in three dimensions.
+		 * \note    An agent solved in the plane keeps its preferred speed along z, and treats its neighbors as vertical cylinders of the combined radius R instead of spheres. No velocity it takes collides in three dimensions within its time horizon if the three-dimensional one would not, and it keeps at most R - sqrt(R^2 - h^2), which is less than h^2 / R, more clearance than the three-dimensional solution, where h is the tolerance. The gaps along z are assumed to change at a constant rate. Has no effect if built with RVO_PLANAR defined as 0.
+		 */
+		RVO_API void setPlanarTolerance(float planarTolerance);
+
 		/**
 		 * \brief   Sets the time step of the simulation.
 		 * \param   timeStep  The time step of the simulation. Must be positive.
@@ -312,13 +505,76 @@ namespace RVO {
 		RVO_API void setTimeStep(float timeStep);
 
 	private:
-		Agent *defaultAgent_;
+		/**
+		 * \brief   The properties of new agents added without them.
+		 */
+		class AgentDefaults {
+		public:
+			Vector3 velocity;
+			size_t maxNeighbors;
+			float maxSpeed;
+			float neighborDist;
+			float radius;
+			float timeHorizon;
+		};
+
+		/**
+		 * \brief   Returns the index of an agent in the agent arrays.
+		 * \param   agentNo  The number of the agent.
+		 */
+		size_t agentIndex(size_t agentNo) const;
+
+		AgentDefaults *defaultAgent_;
 		KdTree *kdTree_;
+		TaskPool *taskPool_;
 		float globalTime_;
 		float timeStep_;
-		std::vector<Agent *> agents_;
-
-		friend class Agent;
+		size_t numVelocityGroups_;
+		size_t velocityGroup_;
+		float planarTolerance_;
+
+		/* Agent numbers: the index of the agent in each slot, RVO_ERROR
+		 * for free slots, and the generation of each slot. */
+		std::vector<size_t> slotAgents_;
+		std::vector<size_t> slotGenerations_;
+		std::vector<size_t> freeSlots_;
+
+		/* The agents, one element of each array per agent. Removing an
+		 * agent moves the last one into its place. */
+		std::vector<size_t> agentNumbers_;
+		std::vector<Vector3> positions_;
+		std::vector<Vector3> velocities_;
+		std::vector<Vector3> prefVelocities_;
+		std::vector<Vector3> newVelocities_;
+		std::vector<float> radii_;
+		std::vector<float> maxSpeeds_;
+		std::vector<float> neighborDists_;
+		std::vector<float> timeHorizons_;
+		std::vector<size_t> maxNeighbors_;
+		std::vector<unsigned char> avoidance_;
+		std::vector<size_t> groups_;
+		std::vector<unsigned char> asleep_;
+
+		/* Set for agents that can sleep by the step computing their new
+		 * velocity, and cleared again when they are put to sleep. */
+		std::vector<unsigned char> canSleep_;
+
+		/* Candidate neighbors, as agent numbers, of agents that have
+		 * hasNeighborList_ set, see setAgentNeighbors. */
+		std::vector<std::vector<size_t> > neighborLists_;
+		std::vector<unsigned char> hasNeighborList_;
+
+		/* The static obstacles, by number. Removed ones have a negative
+		 * radius, and their numbers are in freeObstacles_. */
+		std::vector<Vector3> obstacleCenters_;
+		std::vector<float> obstacleRadii_;
+		std::vector<size_t> freeObstacles_;
+		bool obstaclesChanged_;
+
+		/* One per thread of taskPool_. */
+		std::vector<AgentSolver *> solvers_;
+
+		friend class AgentSolver;
 		friend class KdTree;
 	};
 }
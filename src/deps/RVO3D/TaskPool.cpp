@@ -0,0 +1,115 @@
+/*
+ * TaskPool.cpp
+ * RVO2-3D Library
+ */
+
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace RVO {
+	TaskPool::TaskPool(size_t numThreads) : quit_(false), generation_(0), busyWorkers_(0), task_(NULL), count_(0), chunkSize_(1), numChunks_(0), nextChunk_(0)
+	{
+		assert(numThreads > 0);
+
+		for (size_t i = 1; i < numThreads; ++i) {
+			workers_.push_back(std::thread(&TaskPool::workerMain, this, i));
+		}
+	}
+
+	TaskPool::~TaskPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			quit_ = true;
+		}
+
+		startCond_.notify_all();
+
+		for (size_t i = 0; i < workers_.size(); ++i) {
+			workers_[i].join();
+		}
+	}
+
+	void TaskPool::parallelFor(size_t count, size_t chunkSize, const Task &task)
+	{
+		assert(chunkSize > 0);
+
+		const size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+		if (workers_.empty() || numChunks <= 1) {
+			for (size_t c = 0; c < numChunks; ++c) {
+				task(0, c * chunkSize, std::min(count, (c + 1) * chunkSize));
+			}
+
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			assert(busyWorkers_ == 0);
+			task_ = &task;
+			count_ = count;
+			chunkSize_ = chunkSize;
+			numChunks_ = numChunks;
+			nextChunk_.store(0);
+			busyWorkers_ = workers_.size();
+			++generation_;
+		}
+
+		startCond_.notify_all();
+
+		runChunks(0);
+
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		while (busyWorkers_ > 0) {
+			doneCond_.wait(lock);
+		}
+
+		task_ = NULL;
+	}
+
+	void TaskPool::runChunks(size_t thread)
+	{
+		for (;;) {
+			const size_t c = nextChunk_.fetch_add(1);
+
+			if (c >= numChunks_) {
+				return;
+			}
+
+			(*task_)(thread, c * chunkSize_, std::min(count_, (c + 1) * chunkSize_));
+		}
+	}
+
+	void TaskPool::workerMain(size_t thread)
+	{
+		unsigned int seen = 0;
+
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+
+				while (!quit_ && generation_ == seen) {
+					startCond_.wait(lock);
+				}
+
+				if (quit_) {
+					return;
+				}
+
+				seen = generation_;
+			}
+
+			runChunks(thread);
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (--busyWorkers_ == 0) {
+				doneCond_.notify_one();
+			}
+		}
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * TaskPool.h
+ * RVO2-3D Library
+ */
+
+/**
+ * \file    TaskPool.h
+ * \brief   Contains the TaskPool class.
+ */
+#ifndef RVO_TASK_POOL_H_
+#define RVO_TASK_POOL_H_
+
+#include "API.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RVO {
+	/**
+	 * \brief   Defines a fixed set of threads for the data parallel loops of a simulation step.
+	 *
+	 * A loop is split into chunks of a fixed size, which are handed out to the worker threads and the calling thread. Which thread runs a chunk varies, but the chunks themselves do not depend on the number of threads.
+	 */
+	class TaskPool {
+	public:
+		/**
+		 * \brief   A task over a chunk: the number of the thread running it (zero for the calling thread), and the range [begin, end) of the chunk.
+		 */
+		typedef std::function<void(size_t, size_t, size_t)> Task;
+
+		/**
+		 * \brief   Constructs a task pool instance.
+		 * \param   numThreads  The number of threads running tasks, including the calling thread. Must be positive.
+		 */
+		explicit TaskPool(size_t numThreads);
+
+		/**
+		 * \brief   Destroys this task pool instance, after joining its threads.
+		 */
+		~TaskPool();
+
+		/**
+		 * \brief   Returns the number of threads running tasks, including the calling thread.
+		 */
+		size_t getNumThreads() const { return workers_.size() + 1; }
+
+		/**
+		 * \brief   Runs a task for every chunk of [0, count) and waits until all of them are done. Must not be called from inside a task.
+		 * \param   count      The size of the range.
+		 * \param   chunkSize  The size of the chunks. Must be positive.
+		 * \param   task       The task.
+		 */
+		void parallelFor(size_t count, size_t chunkSize, const Task &task);
+
+	private:
+		TaskPool(const TaskPool &);
+		TaskPool &operator=(const TaskPool &);
+
+		void runChunks(size_t thread);
+		void workerMain(size_t thread);
+
+		std::vector<std::thread> workers_;
+		std::mutex mutex_;
+		std::condition_variable startCond_;
+		std::condition_variable doneCond_;
+		bool quit_;
+		unsigned int generation_;
+		size_t busyWorkers_;
+
+		const Task *task_;
+		size_t count_;
+		size_t chunkSize_;
+		size_t numChunks_;
+		std::atomic<size_t> nextChunk_;
+	};
+}
+
+#endif /* RVO_TASK_POOL_H_ */
@@ -0,0 +1,192 @@
+#include "game/flowfield.h"
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+
+static int opposite(int d) {
+    return (d + 4) & 7;
+}
+
+
+FlowField::FlowField(const NavGrid *grid, int goal) :
+    grid(grid),
+    goal_cell(goal)
+{
+    assert(goal >= 0 && goal < grid->num_cells());
+}
+
+bool FlowField::sample(vec3 pos, vec3 &dir, float &distance) const {
+    int cell = grid->cell_at(pos.x, pos.y);
+    if (cell < 0 || dist[cell] == FLT_MAX)
+        return false;
+
+    int d = next[cell];
+    if (d < 0)
+        dir = vec3(0, 0, 0);
+    else
+        dir = glm::normalize(vec3((float)NavGrid::dir_x[d], (float)NavGrid::dir_y[d], 0.0f));
+    distance = dist[cell];
+    return true;
+}
+
+void FlowField::compute(const std::vector<unsigned char> &blocked) {
+    dist.assign(grid->num_cells(), FLT_MAX);
+    next.assign(grid->num_cells(), -1);
+    queue.clear();
+
+    dist[goal_cell] = 0;
+    push(goal_cell);
+    propagate(blocked);
+}
+
+// Cells that lost their path, because it went through a cell that is now
+// blocked or cut its corner, are cleared along with every cell whose path
+// led through them. The search then starts again from all cells next to
+// the cleared and changed ones, which also finds paths that got shorter.
+void FlowField::repair(const std::vector<unsigned char> &blocked, const std::vector<int> &changed) {
+    cleared.clear();
+    for (int cell : changed) {
+        if (!blocked[cell])
+            continue;
+        invalidate(cell);
+        for (int d = 0; d < 8; ++d) {
+            int n = grid->neighbor(cell, d);
+            if (n >= 0 && next[n] >= 0 && !can_move(blocked, n, next[n]))
+                invalidate(n);
+        }
+    }
+
+    queue.clear();
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int cell : pass == 0 ? changed : cleared) {
+            if (dist[cell] < FLT_MAX)
+                push(cell);
+            for (int d = 0; d < 8; ++d) {
+                int n = grid->neighbor(cell, d);
+                if (n >= 0 && dist[n] < FLT_MAX)
+                    push(n);
+            }
+        }
+    }
+    propagate(blocked);
+}
+
+bool FlowField::can_move(const std::vector<unsigned char> &blocked, int cell, int d) const {
+    int n = grid->neighbor(cell, d);
+    if (n < 0 || (blocked[n] && n != goal_cell))
+        return false;
+    // the corners of a diagonal move are the neighbors on either side
+    if (d & 1)
+        return !blocked[grid->neighbor(cell, d - 1)] && !blocked[grid->neighbor(cell, (d + 1) & 7)];
+    return true;
+}
+
+// clear the cell and every cell whose path leads through it
+void FlowField::invalidate(int cell) {
+    if (cell == goal_cell || dist[cell] == FLT_MAX)
+        return;
+    dist[cell] = FLT_MAX;
+    next[cell] = -1;
+    cleared.push_back(cell);
+    stack.push_back(cell);
+
+    while (!stack.empty()) {
+        int c = stack.back();
+        stack.pop_back();
+        for (int d = 0; d < 8; ++d) {
+            int n = grid->neighbor(c, d);
+            if (n >= 0 && next[n] == opposite(d)) {
+                dist[n] = FLT_MAX;
+                next[n] = -1;
+                cleared.push_back(n);
+                stack.push_back(n);
+            }
+        }
+    }
+}
+
+void FlowField::push(int cell) {
+    queue.push_back(QueueItem(dist[cell], cell));
+    std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>());
+}
+
+void FlowField::propagate(const std::vector<unsigned char> &blocked) {
+    const float cost[2] = { grid->cell_size, grid->cell_size * sqrtf(2.0f) };
+
+    while (!queue.empty()) {
+        std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>());
+        QueueItem item = queue.back();
+        queue.pop_back();
+        int cell = item.second;
+        if (item.first > dist[cell])
+            continue; // already reached by a shorter path
+
+        for (int d = 0; d < 8; ++d) {
+            int n = grid->neighbor(cell, d);
+            int back = opposite(d);
+            if (n < 0 || blocked[n] || !can_move(blocked, n, back))
+                continue;
+            float nd = item.first + cost[d & 1];
+            if (nd < dist[n]) {
+                dist[n] = nd;
+                next[n] = (signed char)back;
+                push(n);
+            }
+        }
+    }
+}
+
+
+FlowFieldCache::FlowFieldCache(float x0, float y0, float x1, float y1, float cell_size, int max_fields) :
+    obstacles(x0, y0, x1, y1, cell_size),
+    max_fields(max_fields),
+    clock(0)
+{
+    assert(max_fields > 0);
+    fields.reserve(max_fields); // field() hands out pointers into it
+}
+
+void FlowFieldCache::begin_obstacles() {
+    obstacles.begin();
+}
+
+void FlowFieldCache::add_obstacle(vec3 pos, float radius) {
+    obstacles.add(pos, radius);
+}
+
+void FlowFieldCache::end_obstacles() {
+    const std::vector<int> &changed = obstacles.end();
+    if (!changed.empty()) {
+        for (FlowField &f : fields)
+            f.repair(obstacles.blocked(), changed);
+    }
+}
+
+const FlowField *FlowFieldCache::field(vec3 goal) {
+    int cell = obstacles.grid().cell_at(goal.x, goal.y);
+    if (cell < 0)
+        return nullptr;
+
+    ++clock;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (fields[i].goal() == cell) {
+            last_used[i] = clock;
+            return &fields[i];
+        }
+    }
+
+    size_t i = fields.size();
+    if ((int)i < max_fields) {
+        fields.push_back(FlowField(&obstacles.grid(), cell));
+        last_used.push_back(clock);
+    } else {
+        i = std::min_element(last_used.begin(), last_used.end()) - last_used.begin();
+        fields[i] = FlowField(&obstacles.grid(), cell);
+        last_used[i] = clock;
+    }
+    fields[i].compute(obstacles.blocked());
+    return &fields[i];
+}
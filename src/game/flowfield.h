@@ -0,0 +1,76 @@
+#ifndef FLOWFIELD_H
+#define FLOWFIELD_H
+
+#include <vector>
+#include "util/mymath.h"
+#include "game/navgrid.h"
+
+// Directions towards one goal cell from every cell of a grid that can
+// reach it, from Dijkstra's algorithm over the 8-connected cells that are
+// not blocked. Diagonal moves must not cut the corner of a blocked cell.
+// Sampling is O(1), so one field can steer any number of ships.
+class FlowField {
+public:
+    FlowField(const NavGrid *grid, int goal);
+
+    int goal() const { return goal_cell; }
+
+    // Direction along the shortest path from pos, which is zero in the goal
+    // cell, and the length of that path. Returns false outside the grid and
+    // where the goal can't be reached from.
+    bool sample(vec3 pos, vec3 &dir, float &distance) const;
+
+    void compute(const std::vector<unsigned char> &blocked);
+
+    // Update the field after the cells in changed were blocked or
+    // unblocked. Only the paths through those cells are searched again.
+    void repair(const std::vector<unsigned char> &blocked, const std::vector<int> &changed);
+
+private:
+    typedef std::pair<float, int> QueueItem; // distance, cell
+
+    bool can_move(const std::vector<unsigned char> &blocked, int cell, int dir) const;
+    void invalidate(int cell);
+    void push(int cell);
+    void propagate(const std::vector<unsigned char> &blocked);
+
+    const NavGrid *grid;
+    int goal_cell;
+    std::vector<float> dist;
+    std::vector<signed char> next; // direction to the next cell, -1 for none
+    std::vector<QueueItem> queue;  // binary heap, nearest first
+    std::vector<int> cleared, stack; // used by repair()
+};
+
+// Flow fields for the most recently used goals, on the grid of a map of
+// obstacles. The cells that became blocked or free when the obstacles
+// change are repaired in every cached field.
+class FlowFieldCache {
+public:
+    FlowFieldCache(float x0, float y0, float x1, float y1, float cell_size, int max_fields);
+
+    // block the cells with centers within radius of each obstacle added
+    // in between
+    void begin_obstacles();
+    void add_obstacle(vec3 pos, float radius);
+    void end_obstacles();
+
+    // the field towards the cell containing goal, computed if it isn't
+    // cached; nullptr if goal is outside the grid
+    const FlowField *field(vec3 goal);
+
+private:
+    // non-copyable, the fields point to the grid
+    FlowFieldCache(const FlowFieldCache &);
+    FlowFieldCache &operator=(const FlowFieldCache &);
+
+    ObstacleMap obstacles;
+
+    int max_fields;
+    std::vector<FlowField> fields;
+    std::vector<unsigned int> last_used;
+    unsigned int clock;
+};
+
+
+#endif
@@ -0,0 +1,81 @@
+#include "game/navgrid.h"
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+
+const int NavGrid::dir_x[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+const int NavGrid::dir_y[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+NavGrid::NavGrid(float x0, float y0, float x1, float y1, float cell_size) :
+    x0(x0), y0(y0), cell_size(cell_size), inv_cell_size(1.0f / cell_size)
+{
+    assert(cell_size > 0);
+    width = std::max(1, (int)ceilf((x1 - x0) * inv_cell_size));
+    height = std::max(1, (int)ceilf((y1 - y0) * inv_cell_size));
+}
+
+int NavGrid::cell_at(float x, float y) const {
+    if (x < x0 || y < y0)
+        return -1;
+    int cx = (int)((x - x0) * inv_cell_size);
+    int cy = (int)((y - y0) * inv_cell_size);
+    if (cx >= width || cy >= height)
+        return -1;
+    return cy * width + cx;
+}
+
+vec3 NavGrid::cell_center(int cell) const {
+    return vec3(x0 + ((cell % width) + 0.5f) * cell_size,
+                y0 + ((cell / width) + 0.5f) * cell_size,
+                0.0f);
+}
+
+
+ObstacleMap::ObstacleMap(float x0, float y0, float x1, float y1, float cell_size) :
+    _grid(x0, y0, x1, y1, cell_size),
+    _blocked(_grid.num_cells(), 0),
+    cover(_grid.num_cells(), 0)
+{
+}
+
+void ObstacleMap::begin() {
+    new_stamped.clear();
+}
+
+void ObstacleMap::add(vec3 pos, float radius) {
+    const NavGrid &g = _grid;
+    int cx0 = std::max(0, (int)floorf((pos.x - radius - g.x0) * g.inv_cell_size));
+    int cy0 = std::max(0, (int)floorf((pos.y - radius - g.y0) * g.inv_cell_size));
+    int cx1 = std::min(g.width - 1, (int)floorf((pos.x + radius - g.x0) * g.inv_cell_size));
+    int cy1 = std::min(g.height - 1, (int)floorf((pos.y + radius - g.y0) * g.inv_cell_size));
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            int cell = cy * g.width + cx;
+            vec3 d = g.cell_center(cell) - vec3(pos.x, pos.y, 0);
+            if (glm::dot(d, d) <= radius * radius)
+                new_stamped.push_back(cell);
+        }
+    }
+}
+
+const std::vector<int> &ObstacleMap::end() {
+    for (int cell : stamped)
+        --cover[cell];
+    for (int cell : new_stamped)
+        ++cover[cell];
+
+    // only cells covered before or now can have changed
+    changed.clear();
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int cell : pass == 0 ? stamped : new_stamped) {
+            unsigned char b = cover[cell] > 0;
+            if (b != _blocked[cell]) {
+                _blocked[cell] = b;
+                changed.push_back(cell);
+            }
+        }
+    }
+    stamped.swap(new_stamped);
+    return changed;
+}
@@ -0,0 +1,62 @@
+#ifndef NAVGRID_H
+#define NAVGRID_H
+
+#include <vector>
+#include "util/mymath.h"
+
+// Square cells over a rectangle of the XY plane, for navigation.
+struct NavGrid {
+    float x0, y0;
+    float cell_size, inv_cell_size;
+    int width, height;
+
+    NavGrid(float x0, float y0, float x1, float y1, float cell_size);
+
+    int num_cells() const { return width * height; }
+
+    // the cell containing (x, y), or -1 outside the grid
+    int cell_at(float x, float y) const;
+
+    vec3 cell_center(int cell) const;
+
+    // the eight neighbor directions, counterclockwise from +x; odd ones
+    // are diagonal, and (d + 4) & 7 is the opposite of d
+    static const int dir_x[8];
+    static const int dir_y[8];
+
+    // the neighbor of cell in direction d, or -1 outside the grid
+    int neighbor(int cell, int d) const {
+        int x = cell % width + dir_x[d];
+        int y = cell / width + dir_y[d];
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return -1;
+        return y * width + x;
+    }
+};
+
+// Cells of a grid blocked by round obstacles. The obstacles are given anew
+// every time they change, and end() reports the cells that became blocked
+// or free, so that anything computed from the map can be updated.
+class ObstacleMap {
+public:
+    ObstacleMap(float x0, float y0, float x1, float y1, float cell_size);
+
+    const NavGrid &grid() const { return _grid; }
+    const std::vector<unsigned char> &blocked() const { return _blocked; }
+
+    // block the cells with centers within radius of each obstacle added
+    // in between; returns the cells that changed
+    void begin();
+    void add(vec3 pos, float radius);
+    const std::vector<int> &end();
+
+private:
+    NavGrid _grid;
+    std::vector<unsigned char> _blocked;
+    std::vector<unsigned short> cover;     // obstacles covering each cell
+    std::vector<int> stamped, new_stamped; // cells covered, once per obstacle
+    std::vector<int> changed;
+};
+
+
+#endif
@@ -0,0 +1,244 @@
+#include "game/octree.h"
+#include "util/list.h"
+
+
+enum {
+    SPLIT_THRESHOLD = 3,
+    MERGE_THRESHOLD = 1,
+
+    // batched updates merge siblings once they hold this many objects or
+    // fewer, leaving a gap to SPLIT_THRESHOLD
+    BATCH_MERGE_THRESHOLD = 2
+};
+
+
+void Octree::Object::octree_remove() {
+    if (octree_node)
+        octree_node->octree->remove(this);
+}
+
+void Octree::Object::octree_update() {
+    if (octree_node) {
+        float x, y, z;
+        octree_position(x, y, z);
+
+        if (!octree_node->contains(x, y, z)) {
+            Octree *octree = octree_node->octree;
+            octree->remove(this);
+            octree->insert(this);
+        }
+    }
+}
+
+
+
+Octree::Octree(float x0, float y0, float z0, float x1, float y1, float z1, int max_depth) : max_depth(max_depth), batching(false) {
+    root = new_node(nullptr, x0, y0, z0, x1, y1, z1);
+}
+
+void Octree::insert(Object *obj) {
+    insert(root, obj);
+}
+
+void Octree::insert(Node *n, Object *obj) {
+    assert(!obj->octree_node);
+    assert(!obj->octree_link.is_linked());
+
+    if (!n->child[0]) {
+        // we are a leaf node; check if there is space
+        // (while batching, leaves are allowed to overflow until end_batch)
+        if (n->num_objects < SPLIT_THRESHOLD || n->depth == max_depth || batching) {
+            obj->octree_node = n;
+            n->objects.push_back(obj);
+            ++n->num_objects;
+            if (batching)
+                mark_dirty(n);
+            return;
+        }
+
+        // this node is full; split into eight children
+        split(n);
+    }
+
+    // this is an internal node, so we recurse
+    float x, y, z;
+    obj->octree_position(x, y, z);
+    insert(n->calc_child(x, y, z), obj);
+}
+
+void Octree::split(Node *n) {
+    assert(!n->child[0]);
+
+    for (int i = 0; i < 8; ++i) {
+        n->child[i] = new_node(n,
+            (i & 1) ? n->center_x : n->x0,
+            (i & 2) ? n->center_y : n->y0,
+            (i & 4) ? n->center_z : n->z0,
+            (i & 1) ? n->x1 : n->center_x,
+            (i & 2) ? n->y1 : n->center_y,
+            (i & 4) ? n->z1 : n->center_z);
+    }
+
+    // spread objects among children
+    while (n->num_objects) {
+        Object *obj = n->objects.front();
+        n->remove(obj);
+        float x, y, z;
+        obj->octree_position(x, y, z);
+        insert(n->calc_child(x, y, z), obj);
+    }
+    assert(n->objects.empty());
+}
+
+void Octree::remove(Object *obj) {
+    Node *n = obj->octree_node;
+    if (!n)
+        return; // it has not been inserted yet, so nothing to do
+
+    assert(!n->child[0]);
+
+    n->remove(obj);
+
+    if (batching) {
+        mark_dirty(n);
+        return;
+    }
+
+    // only when a removal leaves the count below or at MERGE_THRESHOLD do we
+    // investigate merging the node with its siblings
+    if (n->num_objects <= MERGE_THRESHOLD)
+        maybe_merge_with_siblings(n);
+}
+
+void Octree::maybe_merge_with_siblings(Node *n) {
+    Node *parent = n->parent;
+    if (!parent)
+        return; // can't merge any more since we're at the root node
+
+    assert(parent->child[0]);
+    assert(!parent->num_objects);
+    assert(parent->objects.empty());
+
+    // count all objects in all siblings
+    int count = 0;
+    for (int i = 0; i < 8; ++i) {
+        Node *c = parent->child[i];
+        if (c->child[0])
+            return; // we can't merge if parent has non-leaf children
+        count += c->num_objects;
+    }
+
+    // if the count is greater than the split threshold,
+    // the node should remain split
+    if (count > SPLIT_THRESHOLD)
+        return;
+
+    // remove child nodes from parent
+    Node *child[8];
+    for (int i = 0; i < 8; ++i) {
+        child[i] = parent->child[i];
+        parent->child[i] = nullptr;
+    }
+
+    // insert all their objects into the parent, then release the nodes
+    for (int i = 0; i < 8; ++i) {
+        Node *c = child[i];
+        while (c->num_objects) {
+            Object *obj = c->objects.front();
+            c->remove(obj);
+            insert(parent, obj);
+        }
+        free_node(c);
+    }
+
+    // recurse here, since there may be opportunity for even more merging
+    maybe_merge_with_siblings(parent);
+}
+
+void Octree::begin_batch() {
+    assert(!batching);
+    batching = true;
+}
+
+void Octree::end_batch() {
+    assert(batching);
+    rebalance(root);
+    batching = false;
+}
+
+void Octree::mark_dirty(Node *n) {
+    // if a node is dirty, so are all of its ancestors
+    while (n && !n->dirty) {
+        n->dirty = true;
+        n = n->parent;
+    }
+}
+
+void Octree::rebalance(Node *n) {
+    if (!n->dirty)
+        return;
+
+    if (!n->child[0]) {
+        if (n->num_objects > SPLIT_THRESHOLD && n->depth < max_depth) {
+            // the new children come out dirty, so they are visited below and
+            // split further if necessary
+            split(n);
+        }
+    }
+
+    if (n->child[0]) {
+        int count = 0;
+        bool all_leaves = true;
+        for (int i = 0; i < 8; ++i) {
+            rebalance(n->child[i]);
+            count += n->child[i]->num_objects;
+            if (n->child[i]->child[0])
+                all_leaves = false;
+        }
+
+        if (all_leaves && count <= BATCH_MERGE_THRESHOLD) {
+            // pull the objects of the children up into this node
+            for (int i = 0; i < 8; ++i) {
+                Node *c = n->child[i];
+                n->child[i] = nullptr;
+                while (c->num_objects) {
+                    Object *obj = c->objects.front();
+                    c->remove(obj);
+                    obj->octree_node = n;
+                    n->objects.push_back(obj);
+                    ++n->num_objects;
+                }
+                free_node(c);
+            }
+        }
+    }
+
+    n->dirty = false;
+}
+
+Octree::Node *Octree::new_node(Node *parent, float x0, float y0, float z0, float x1, float y1, float z1) {
+    Node *n = pool.create();
+    n->x0 = x0;
+    n->y0 = y0;
+    n->z0 = z0;
+    n->x1 = x1;
+    n->y1 = y1;
+    n->z1 = z1;
+    n->center_x = x0 + (x1 - x0) * 0.5f;
+    n->center_y = y0 + (y1 - y0) * 0.5f;
+    n->center_z = z0 + (z1 - z0) * 0.5f;
+    n->octree = this;
+    n->parent = parent;
+    n->depth = parent ? parent->depth + 1 : 0;
+    n->dirty = false;
+    for (int i = 0; i < 8; ++i)
+        n->child[i] = nullptr;
+    n->num_objects = 0;
+    return n;
+}
+
+void Octree::free_node(Node *n) {
+    assert(!n->child[0]);
+    assert(n->objects.empty());
+    pool.free(n);
+}
@@ -0,0 +1,195 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include "util/list.h"
+#include "util/pool.h"
+
+// Octree counterpart of QuadTree, for objects that are spread out in all
+// three dimensions. The interface mirrors QuadTree: objects derive from
+// Octree::Object, and queries hand every object stored in a leaf that
+// touches the query volume to the callback, so callers still do their own
+// exact distance checks.
+class Octree {
+    class Node;
+public:
+    // objects that want to be stored in the tree must derive from this
+    class Object {
+    public:
+        Object() : octree_node(nullptr) {}
+        virtual ~Object() { octree_remove(); }
+
+        void octree_remove();
+        void octree_update(); // call after position has changed
+
+        virtual void octree_position(float &x, float &y, float &z) = 0;
+
+    private:
+        friend class Octree;
+        friend class Node;
+        class Octree::Node *octree_node;
+        ListLink octree_link;
+    };
+
+    Octree(float x0, float y0, float z0, float x1, float y1, float z1, int max_depth);
+
+    void insert(Object *obj);
+    void remove(Object *obj);
+
+    // batched updates, see QuadTree::begin_batch
+    void begin_batch();
+    void end_batch();
+
+    // visit objects in all leaves overlapping the box [x0,x1] x [y0,y1] x [z0,z1]
+    template <class Func>
+    void query(float x0, float y0, float z0, float x1, float y1, float z1, Func func) {
+        root->query(x0, y0, z0, x1, y1, z1, func);
+    }
+
+    // visit objects in all leaves overlapping the sphere at (x, y, z)
+    template <class Func>
+    void query_sphere(float x, float y, float z, float radius, Func func) {
+        root->query_sphere(x, y, z, radius * radius, func);
+    }
+
+    // describe the tree to a SpatialSnapshot; add(obj) adds each object
+    template <class Builder, class Func>
+    void flatten(Builder &builder, Func add) {
+        root->flatten(builder, add);
+    }
+
+    // same as QuadTree::gather_outlines, projected onto the XY plane
+    template <class Func>
+    void gather_outlines(Func func) {
+        func(root->x0, root->y0); func(root->x1, root->y0);
+        func(root->x0, root->y0); func(root->x0, root->y1);
+        func(root->x1, root->y1); func(root->x0, root->y1);
+        func(root->x1, root->y1); func(root->x1, root->y0);
+
+        root->gather_crosses(func);
+    }
+
+private:
+    class Node {
+    public:
+        float x0, y0, z0, x1, y1, z1;
+        float center_x, center_y, center_z;
+        Octree *octree;
+        Node *parent;
+        int depth;
+        bool dirty; // needs rebalancing at the end of the batch
+
+        // child index bits: 1 = upper x half, 2 = upper y half, 4 = upper z half
+        Node *child[8];
+
+        List<Object, &Object::octree_link> objects;
+        int num_objects;
+
+
+        void remove(Object *obj) {
+            obj->octree_link.unlink();
+            obj->octree_node = nullptr;
+            --num_objects;
+        }
+
+        int calc_index(float x, float y, float z) {
+            return (x < center_x ? 0 : 1) |
+                   (y < center_y ? 0 : 2) |
+                   (z < center_z ? 0 : 4);
+        }
+
+        Node *calc_child(float x, float y, float z) {
+            return child[calc_index(x, y, z)];
+        }
+
+        bool contains(float x, float y, float z) {
+            return !(x < x0 || y < y0 || z < z0 ||
+                     x > x1 || y > y1 || z > z1);
+        }
+
+        template <class Func>
+        void query(float qx0, float qy0, float qz0, float qx1, float qy1, float qz1, Func func) {
+            if (child[0]) {
+                // only descend into the halves the box reaches on each axis
+                int lo = (qx0 < center_x ? 0 : 1) | (qy0 < center_y ? 0 : 2) | (qz0 < center_z ? 0 : 4);
+                int hi = (qx1 > center_x ? 1 : 0) | (qy1 > center_y ? 2 : 0) | (qz1 > center_z ? 4 : 0);
+                for (int i = 0; i < 8; ++i) {
+                    if ((i | hi) == hi && (i & lo) == lo)
+                        child[i]->query(qx0, qy0, qz0, qx1, qy1, qz1, func);
+                }
+            } else {
+                for (Object *obj : objects)
+                    func(obj);
+            }
+        }
+
+        template <class Func>
+        void query_sphere(float x, float y, float z, float radius_squared, Func func) {
+            if (child[0]) {
+                // distance from the sphere center to each of the splitting
+                // planes; children are only tested against the planes, not
+                // their outer faces, since objects outside the root bounds
+                // are kept in the outermost leaves
+                float dx = x - center_x, dy = y - center_y, dz = z - center_z;
+                float dx2 = dx*dx, dy2 = dy*dy, dz2 = dz*dz;
+                int side = calc_index(x, y, z);
+                for (int i = 0; i < 8; ++i) {
+                    int cross = i ^ side;
+                    float dist_squared = ((cross & 1) ? dx2 : 0.0f) +
+                                         ((cross & 2) ? dy2 : 0.0f) +
+                                         ((cross & 4) ? dz2 : 0.0f);
+                    if (dist_squared <= radius_squared)
+                        child[i]->query_sphere(x, y, z, radius_squared, func);
+                }
+            } else {
+                for (Object *obj : objects)
+                    func(obj);
+            }
+        }
+
+        template <class Builder, class Func>
+        void flatten(Builder &builder, Func add) {
+            builder.open_node();
+            if (child[0]) {
+                for (int i = 0; i < 8; ++i)
+                    child[i]->flatten(builder, add);
+            } else {
+                for (Object *obj : objects)
+                    add(obj);
+            }
+            builder.close_node();
+        }
+
+        template <class Func>
+        void gather_crosses(Func func) {
+            if (!child[0])
+                return;
+
+            func(x0, center_y); func(x1, center_y);
+            func(center_x, y0); func(center_x, y1);
+
+            for (int i = 0; i < 8; ++i)
+                child[i]->gather_crosses(func);
+        }
+    };
+
+    // non-copyable
+    Octree(const Octree &);
+    Octree &operator=(const Octree &);
+
+    void insert(Node *n, Object *obj);
+    void split(Node *n);
+    void maybe_merge_with_siblings(Node *n);
+    void mark_dirty(Node *n);
+    void rebalance(Node *n);
+
+    Node *new_node(Node *parent, float x0, float y0, float z0, float x1, float y1, float z1);
+    void free_node(Node *n);
+
+    Pool<Node> pool;
+    int max_depth;
+    Node *root;
+    bool batching;
+};
+
+
+#endif
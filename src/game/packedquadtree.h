@@ -0,0 +1,359 @@
+#ifndef PACKEDQUADTREE_H
+#define PACKEDQUADTREE_H
+
+#include <vector>
+#include <cassert>
+#include "util/pool.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PACKEDQUADTREE_SSE
+#endif
+
+// Variant of QuadTree that doesn't require objects to derive from anything.
+// Instead of linking objects into the leaves, every leaf keeps contiguous
+// arrays of object positions, which are copied in by insert() and update().
+// Queries test these copies (four at a time where SSE is available) and only
+// hand objects that actually lie inside the query area to the callback, so
+// objects outside of it are never touched.
+//
+// Objects are identified by the handle returned from insert(), which stays
+// valid until the object is removed.
+template <class T>
+class PackedQuadTree {
+    struct Node;
+public:
+    typedef int Handle;
+
+    PackedQuadTree(float x0, float y0, float x1, float y1, int max_depth) : max_depth(max_depth) {
+        root = new_node(nullptr, x0, y0, x1, y1);
+    }
+
+    ~PackedQuadTree() {
+        free_subtree(root);
+    }
+
+    Handle insert(T *obj, float x, float y) {
+        Handle h;
+        if (free_handles.empty()) {
+            h = (Handle)slots.size();
+            slots.push_back(Slot());
+        } else {
+            h = free_handles.back();
+            free_handles.pop_back();
+        }
+        insert(root, h, obj, x, y);
+        return h;
+    }
+
+    void remove(Handle h) {
+        Slot &s = slots[h];
+        assert(s.node);
+        Node *n = s.node;
+        remove_entry(n, s.index);
+        s.node = nullptr;
+        free_handles.push_back(h);
+        maybe_merge(n->parent);
+    }
+
+    // call after position has changed
+    void update(Handle h, float x, float y) {
+        Slot &s = slots[h];
+        Node *n = s.node;
+        assert(n);
+
+        if (n->contains(x, y)) {
+            n->xs[s.index] = x;
+            n->ys[s.index] = y;
+            return;
+        }
+
+        T *obj = n->objs[s.index];
+        remove_entry(n, s.index);
+        maybe_merge(n->parent);
+        insert(root, h, obj, x, y);
+    }
+
+    // visit objects inside the rectangle
+    template <class Func>
+    void query(float x0, float y0, float x1, float y1, Func func) {
+        root->query(x0, y0, x1, y1, func);
+    }
+
+    // visit objects inside the circle
+    template <class Func>
+    void query_circle(float x, float y, float radius, Func func) {
+        root->query_circle(x, y, radius, func);
+    }
+
+    // describe the tree to a SpatialSnapshot; add(obj) is called for every
+    // object and has to add it to the builder
+    template <class Builder, class Func>
+    void flatten(Builder &builder, Func add) {
+        root->flatten(builder, add);
+    }
+
+    template <class Func>
+    void gather_outlines(Func func) {
+        func(root->x0, root->y0); func(root->x1, root->y0);
+        func(root->x0, root->y0); func(root->x0, root->y1);
+        func(root->x1, root->y1); func(root->x0, root->y1);
+        func(root->x1, root->y1); func(root->x1, root->y0);
+
+        root->gather_crosses(func);
+    }
+
+private:
+    enum {
+        // leaves are cheap to scan, so they hold more objects than
+        // QuadTree's; merging waits until siblings are half as full, so
+        // objects moving back and forth don't cause constant restructuring
+        SPLIT_THRESHOLD = 16,
+        MERGE_THRESHOLD = 8
+    };
+
+    struct Slot {
+        Node *node;
+        int index;
+    };
+
+    struct Node {
+        float x0, y0, x1, y1;
+        float center_x, center_y;
+        Node *parent;
+        int depth;
+
+        Node *child[4];
+
+        // leaf contents, one element per object
+        std::vector<float> xs, ys;
+        std::vector<T *> objs;
+        std::vector<Handle> handles;
+
+        int num_objects() { return (int)objs.size(); }
+
+        bool contains(float x, float y) {
+            return !(x < x0 || y < y0 || x > x1 || y > y1);
+        }
+
+        int calc_index(float x, float y) {
+            if (y < center_y)
+                return x < center_x ? 0 : 1;
+            return x < center_x ? 2 : 3;
+        }
+
+        template <class Func>
+        void query(float qx0, float qy0, float qx1, float qy1, Func func) {
+            if (child[0]) {
+                if (qy0 < center_y) {
+                    if (qx0 < center_x) child[0]->query(qx0, qy0, qx1, qy1, func);
+                    if (qx1 > center_x) child[1]->query(qx0, qy0, qx1, qy1, func);
+                }
+                if (qy1 > center_y) {
+                    if (qx0 < center_x) child[2]->query(qx0, qy0, qx1, qy1, func);
+                    if (qx1 > center_x) child[3]->query(qx0, qy0, qx1, qy1, func);
+                }
+                return;
+            }
+
+            int n = num_objects();
+            int i = 0;
+#ifdef PACKEDQUADTREE_SSE
+            const __m128 vx0 = _mm_set1_ps(qx0), vy0 = _mm_set1_ps(qy0);
+            const __m128 vx1 = _mm_set1_ps(qx1), vy1 = _mm_set1_ps(qy1);
+            for (; i + 4 <= n; i += 4) {
+                __m128 x = _mm_loadu_ps(&xs[i]);
+                __m128 y = _mm_loadu_ps(&ys[i]);
+                __m128 inside = _mm_and_ps(
+                    _mm_and_ps(_mm_cmpge_ps(x, vx0), _mm_cmple_ps(x, vx1)),
+                    _mm_and_ps(_mm_cmpge_ps(y, vy0), _mm_cmple_ps(y, vy1)));
+                int mask = _mm_movemask_ps(inside);
+                for (int j = 0; mask; ++j, mask >>= 1) {
+                    if (mask & 1)
+                        func(objs[i + j]);
+                }
+            }
+#endif
+            for (; i < n; ++i) {
+                if (xs[i] >= qx0 && xs[i] <= qx1 && ys[i] >= qy0 && ys[i] <= qy1)
+                    func(objs[i]);
+            }
+        }
+
+        template <class Func>
+        void query_circle(float x, float y, float radius, Func func) {
+            if (child[0]) {
+                if (y - radius < center_y) {
+                    if (x - radius < center_x) child[0]->query_circle(x, y, radius, func);
+                    if (x + radius > center_x) child[1]->query_circle(x, y, radius, func);
+                }
+                if (y + radius > center_y) {
+                    if (x - radius < center_x) child[2]->query_circle(x, y, radius, func);
+                    if (x + radius > center_x) child[3]->query_circle(x, y, radius, func);
+                }
+                return;
+            }
+
+            float radius_squared = radius * radius;
+            int n = num_objects();
+            int i = 0;
+#ifdef PACKEDQUADTREE_SSE
+            const __m128 vx = _mm_set1_ps(x), vy = _mm_set1_ps(y);
+            const __m128 vr = _mm_set1_ps(radius_squared);
+            for (; i + 4 <= n; i += 4) {
+                __m128 dx = _mm_sub_ps(_mm_loadu_ps(&xs[i]), vx);
+                __m128 dy = _mm_sub_ps(_mm_loadu_ps(&ys[i]), vy);
+                __m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+                int mask = _mm_movemask_ps(_mm_cmple_ps(d, vr));
+                for (int j = 0; mask; ++j, mask >>= 1) {
+                    if (mask & 1)
+                        func(objs[i + j]);
+                }
+            }
+#endif
+            for (; i < n; ++i) {
+                float dx = xs[i] - x, dy = ys[i] - y;
+                if (dx*dx + dy*dy <= radius_squared)
+                    func(objs[i]);
+            }
+        }
+
+        template <class Builder, class Func>
+        void flatten(Builder &builder, Func add) {
+            builder.open_node();
+            if (child[0]) {
+                for (int i = 0; i < 4; ++i)
+                    child[i]->flatten(builder, add);
+            } else {
+                for (int i = 0; i < num_objects(); ++i)
+                    add(objs[i]);
+            }
+            builder.close_node();
+        }
+
+        template <class Func>
+        void gather_crosses(Func func) {
+            if (!child[0])
+                return;
+
+            func(x0, center_y); func(x1, center_y);
+            func(center_x, y0); func(center_x, y1);
+
+            for (int i = 0; i < 4; ++i)
+                child[i]->gather_crosses(func);
+        }
+    };
+
+    // non-copyable
+    PackedQuadTree(const PackedQuadTree &);
+    PackedQuadTree &operator=(const PackedQuadTree &);
+
+    void insert(Node *n, Handle h, T *obj, float x, float y) {
+        while (n->child[0] || (n->num_objects() >= SPLIT_THRESHOLD && n->depth < max_depth)) {
+            if (!n->child[0])
+                split(n);
+            n = n->child[n->calc_index(x, y)];
+        }
+        add_entry(n, h, obj, x, y);
+    }
+
+    void add_entry(Node *n, Handle h, T *obj, float x, float y) {
+        slots[h].node = n;
+        slots[h].index = n->num_objects();
+        n->xs.push_back(x);
+        n->ys.push_back(y);
+        n->objs.push_back(obj);
+        n->handles.push_back(h);
+    }
+
+    // moves the last entry into the hole
+    void remove_entry(Node *n, int index) {
+        int last = n->num_objects() - 1;
+        if (index != last) {
+            n->xs[index] = n->xs[last];
+            n->ys[index] = n->ys[last];
+            n->objs[index] = n->objs[last];
+            n->handles[index] = n->handles[last];
+            slots[n->handles[index]].index = index;
+        }
+        n->xs.pop_back();
+        n->ys.pop_back();
+        n->objs.pop_back();
+        n->handles.pop_back();
+    }
+
+    void split(Node *n) {
+        float w = (n->x1 - n->x0) * 0.5f;
+        float h = (n->y1 - n->y0) * 0.5f;
+        n->child[0] = new_node(n, n->x0, n->y0, n->x0 + w, n->y0 + h);
+        n->child[1] = new_node(n, n->x0 + w, n->y0, n->x1, n->y0 + h);
+        n->child[2] = new_node(n, n->x0, n->y0 + h, n->x0 + w, n->y1);
+        n->child[3] = new_node(n, n->x0 + w, n->y0 + h, n->x1, n->y1);
+
+        // spread entries among children, using the cached positions
+        for (int i = 0; i < n->num_objects(); ++i) {
+            Node *c = n->child[n->calc_index(n->xs[i], n->ys[i])];
+            add_entry(c, n->handles[i], n->objs[i], n->xs[i], n->ys[i]);
+        }
+        n->xs.clear();
+        n->ys.clear();
+        n->objs.clear();
+        n->handles.clear();
+    }
+
+    void maybe_merge(Node *n) {
+        // walk up as long as there is something to merge
+        while (n) {
+            int count = 0;
+            for (int i = 0; i < 4; ++i) {
+                if (n->child[i]->child[0])
+                    return; // we can't merge if there are non-leaf children
+                count += n->child[i]->num_objects();
+            }
+            if (count > MERGE_THRESHOLD)
+                return;
+
+            for (int i = 0; i < 4; ++i) {
+                Node *c = n->child[i];
+                n->child[i] = nullptr;
+                for (int j = 0; j < c->num_objects(); ++j)
+                    add_entry(n, c->handles[j], c->objs[j], c->xs[j], c->ys[j]);
+                pool.free(c);
+            }
+            n = n->parent;
+        }
+    }
+
+    void free_subtree(Node *n) {
+        if (n->child[0]) {
+            for (int i = 0; i < 4; ++i)
+                free_subtree(n->child[i]);
+        }
+        pool.free(n);
+    }
+
+    Node *new_node(Node *parent, float x0, float y0, float x1, float y1) {
+        Node *n = pool.create();
+        n->x0 = x0;
+        n->y0 = y0;
+        n->x1 = x1;
+        n->y1 = y1;
+        n->center_x = x0 + (x1 - x0) * 0.5f;
+        n->center_y = y0 + (y1 - y0) * 0.5f;
+        n->parent = parent;
+        n->depth = parent ? parent->depth + 1 : 0;
+        for (int i = 0; i < 4; ++i)
+            n->child[i] = nullptr;
+        return n;
+    }
+
+    Pool<Node> pool;
+    int max_depth;
+    Node *root;
+
+    std::vector<Slot> slots;
+    std::vector<Handle> free_handles;
+};
+
+
+#endif
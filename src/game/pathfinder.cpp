@@ -0,0 +1,684 @@
+#include "game/pathfinder.h"
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+
+
+// entrances shorter than this get one pair of nodes in the middle, longer
+// ones a pair at each end
+static const int MAX_SINGLE_ENTRANCE = 6;
+
+// what a search is taken to cost until some have been timed, in seconds
+static const float INITIAL_SEARCH_TIME = 0.001f;
+
+// weight of the latest search in the running average of their times
+static const float SEARCH_TIME_WEIGHT = 0.1f;
+
+typedef std::pair<float, int> QueueItem; // priority, cell or node
+
+static void push(std::vector<QueueItem> &queue, float priority, int item) {
+    queue.push_back(QueueItem(priority, item));
+    std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>());
+}
+
+static QueueItem pop(std::vector<QueueItem> &queue) {
+    std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>());
+    QueueItem item = queue.back();
+    queue.pop_back();
+    return item;
+}
+
+// shortest distance between two cells with 8-connected moves and nothing
+// in the way
+static float octile(const NavGrid &g, int a, int b) {
+    int dx = abs(a % g.width - b % g.width);
+    int dy = abs(a / g.width - b / g.width);
+    int diagonal = std::min(dx, dy);
+    return ((dx + dy - 2 * diagonal) + diagonal * sqrtf(2.0f)) * g.cell_size;
+}
+
+
+PathFinder::PathFinder(float x0, float y0, float x1, float y1, float cell_size,
+                       int cluster_size, int cache_size) :
+    obstacles(x0, y0, x1, y1, cell_size),
+    cluster_size(cluster_size),
+    cache_size(cache_size),
+    clock(0),
+    generation(0),
+    search_time(INITIAL_SEARCH_TIME),
+    quit(false)
+{
+    assert(cluster_size > 0 && cache_size > 0);
+    const NavGrid &g = obstacles.grid();
+    clusters_x = (g.width + cluster_size - 1) / cluster_size;
+    clusters_y = (g.height + cluster_size - 1) / cluster_size;
+    _stats.cache_hits = 0;
+    _stats.cache_misses = 0;
+    cell_node.assign(g.num_cells(), -1);
+    cluster_nodes.resize(clusters_x * clusters_y);
+    changed_clusters.assign(clusters_x * clusters_y, 0);
+    build_graph(std::vector<unsigned char>(clusters_x * clusters_y, 1));
+    worker = std::thread(&PathFinder::worker_main, this);
+}
+
+PathFinder::~PathFinder() {
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        quit = true;
+    }
+    job_cond.notify_all();
+    worker.join();
+    for (Job *j : issued)
+        delete j;
+}
+
+void PathFinder::begin_obstacles() {
+    obstacles.begin();
+}
+
+void PathFinder::add_obstacle(vec3 pos, float radius) {
+    obstacles.add(pos, radius);
+}
+
+bool PathFinder::end_obstacles() {
+    std::lock_guard<std::mutex> lock(graph_mutex);
+    const std::vector<int> &changed = obstacles.end();
+    if (changed.empty())
+        return false;
+
+    changed_clusters.assign(clusters_x * clusters_y, 0);
+    for (int cell : changed)
+        changed_clusters[cluster_of(cell)] = 1;
+
+    // the entrances on the borders of a changed cluster may have moved, so
+    // its neighbors get new nodes there too
+    std::vector<unsigned char> rebuild(changed_clusters);
+    for (int c = 0; c < (int)changed_clusters.size(); ++c) {
+        if (!changed_clusters[c])
+            continue;
+        int cx = c % clusters_x, cy = c / clusters_x;
+        if (cx > 0) rebuild[c - 1] = 1;
+        if (cx + 1 < clusters_x) rebuild[c + 1] = 1;
+        if (cy > 0) rebuild[c - clusters_x] = 1;
+        if (cy + 1 < clusters_y) rebuild[c + clusters_x] = 1;
+    }
+    build_graph(rebuild);
+    ++generation;
+    return true;
+}
+
+bool PathFinder::crosses_changes(vec3 from, const std::vector<vec3> &waypoints, size_t next) const {
+    const NavGrid &g = obstacles.grid();
+    for (size_t i = next; i < waypoints.size(); ++i) {
+        vec3 to = waypoints[i];
+        int steps = std::max(1, (int)ceilf(glm::length(to - from) * g.inv_cell_size * 2.0f));
+        for (int s = 0; s <= steps; ++s) {
+            vec3 p = glm::mix(from, to, (float)s / (float)steps);
+            int cell = g.cell_at(p.x, p.y);
+            if (cell >= 0 && changed_clusters[cluster_of(cell)])
+                return true;
+        }
+        from = to;
+    }
+    return false;
+}
+
+bool PathFinder::find_path(vec3 start_pos, vec3 goal_pos, std::vector<vec3> &waypoints) {
+    const NavGrid &g = obstacles.grid();
+    int start = g.cell_at(start_pos.x, start_pos.y);
+    int goal = g.cell_at(goal_pos.x, goal_pos.y);
+    if (start < 0 || goal < 0 || obstacles.blocked()[goal])
+        return false;
+
+    std::vector<int> cells;
+    bool found = false;
+    if (!obstacles.blocked()[start]) {
+        found = find_cells(start, goal, cells);
+    } else {
+        // start inside an obstacle: get out of it first, by any free
+        // neighbor that leads to goal
+        const std::vector<unsigned char> &blocked = obstacles.blocked();
+        for (int d = 0; d < 8 && !found; ++d) {
+            int n = g.neighbor(start, d);
+            if (n < 0 || blocked[n])
+                continue;
+            if ((d & 1) && (blocked[g.neighbor(start, d - 1)] || blocked[g.neighbor(start, (d + 1) & 7)]))
+                continue;
+            found = find_cells(n, goal, cells);
+        }
+        if (found)
+            cells.insert(cells.begin(), start);
+    }
+    if (!found)
+        return false;
+
+    // keep only the cells where the path has to turn to stay clear
+    waypoints.clear();
+    size_t anchor = 0;
+    for (size_t i = 2; i < cells.size(); ++i) {
+        if (!line_of_sight(cells[anchor], cells[i])) {
+            anchor = i - 1;
+            waypoints.push_back(g.cell_center(cells[anchor]));
+        }
+    }
+    waypoints.push_back(goal_pos);
+    return true;
+}
+
+bool PathFinder::find_cells(int start, int goal, std::vector<int> &cells) {
+    int start_cluster = cluster_of(start);
+    int goal_cluster = cluster_of(goal);
+
+    if (start_cluster == goal_cluster) {
+        std::vector<float> dist;
+        if (search_cluster(start_cluster, start, goal, dist, &cells) < FLT_MAX)
+            return true;
+    }
+
+    std::vector<int> path_nodes;
+    if (find_cached(start_cluster, goal_cluster, path_nodes) && refine(start, goal, path_nodes, cells))
+        return true;
+    if (!search_nodes(start, goal, path_nodes))
+        return false;
+    add_cached(start_cluster, goal_cluster, path_nodes);
+    return refine(start, goal, path_nodes, cells);
+}
+
+void PathFinder::request(PathRequest *r, vec3 start, vec3 goal) {
+    cancel(r);
+    r->state = PathRequest::PENDING;
+    r->start = start;
+    r->goal = goal;
+    r->waypoints.clear();
+    pending.push_back(r);
+}
+
+void PathFinder::cancel(PathRequest *r) {
+    if (r->state == PathRequest::PENDING) {
+        std::vector<PathRequest *>::iterator p = std::find(pending.begin(), pending.end(), r);
+        if (p != pending.end()) {
+            pending.erase(p);
+        } else {
+            std::lock_guard<std::mutex> lock(job_mutex);
+            for (Job *j : issued) {
+                if (j->request == r) {
+                    j->request = nullptr;
+                    j->cancelled = true;
+                }
+            }
+        }
+    }
+    r->state = PathRequest::IDLE;
+}
+
+void PathFinder::service(float budget) {
+    std::vector<Job *> finished;
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        size_t kept = 0;
+        for (Job *j : issued) {
+            if (j->done)
+                finished.push_back(j);
+            else
+                issued[kept++] = j;
+        }
+        issued.resize(kept);
+    }
+
+    std::vector<PathRequest *> again;
+    for (Job *j : finished) {
+        PathRequest *r = j->request;
+        if (r && j->generation != generation) {
+            again.push_back(r);
+        } else if (r) {
+            r->waypoints.swap(j->waypoints);
+            r->state = j->found ? PathRequest::DONE : PathRequest::FAILED;
+        }
+        delete j;
+    }
+    pending.insert(pending.begin(), again.begin(), again.end());
+
+    std::lock_guard<std::mutex> lock(job_mutex);
+    size_t count = 0;
+    while (count < pending.size() && issued.size() * search_time < budget) {
+        PathRequest *r = pending[count++];
+        Job *j = new Job;
+        j->request = r;
+        j->start = r->start;
+        j->goal = r->goal;
+        j->cancelled = false;
+        j->done = false;
+        j->found = false;
+        j->generation = 0;
+        issued.push_back(j);
+        queue.push_back(j);
+    }
+    pending.erase(pending.begin(), pending.begin() + count);
+    if (count > 0)
+        job_cond.notify_one();
+}
+
+void PathFinder::worker_main() {
+    for (;;) {
+        Job *j;
+        bool cancelled;
+        {
+            std::unique_lock<std::mutex> lock(job_mutex);
+            while (!quit && queue.empty())
+                job_cond.wait(lock);
+            if (quit)
+                return;
+            j = queue.front();
+            queue.pop_front();
+            cancelled = j->cancelled;
+        }
+
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        if (!cancelled) {
+            std::lock_guard<std::mutex> lock(graph_mutex);
+            j->found = find_path(j->start, j->goal, j->waypoints);
+            j->generation = generation;
+        }
+        std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - started;
+
+        std::lock_guard<std::mutex> lock(job_mutex);
+        j->done = true;
+        if (!cancelled)
+            search_time += (elapsed.count() - search_time) * SEARCH_TIME_WEIGHT;
+    }
+}
+
+PathFinder::Stats PathFinder::stats() const {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return _stats;
+}
+
+int PathFinder::cluster_of(int cell) const {
+    const NavGrid &g = obstacles.grid();
+    return (cell / g.width / cluster_size) * clusters_x + (cell % g.width) / cluster_size;
+}
+
+PathFinder::Bounds PathFinder::cluster_bounds(int cluster) const {
+    const NavGrid &g = obstacles.grid();
+    Bounds b;
+    b.x0 = (cluster % clusters_x) * cluster_size;
+    b.y0 = (cluster / clusters_x) * cluster_size;
+    b.x1 = std::min(b.x0 + cluster_size, g.width);
+    b.y1 = std::min(b.y0 + cluster_size, g.height);
+    return b;
+}
+
+// Rebuilds the nodes of the clusters flagged in rebuild, the entrances on
+// their borders and the edges inside them. The neighbors of a changed
+// cluster have to be flagged too. Then the other clusters keep their nodes
+// and edges: their cells are the same, and so are the entrances on each
+// of their borders, as the cluster on the other side hasn't changed
+// either. Only the edges of their entrances into rebuilt clusters are
+// made again.
+void PathFinder::build_graph(const std::vector<unsigned char> &rebuild) {
+    const NavGrid &g = obstacles.grid();
+    int num_clusters = clusters_x * clusters_y;
+
+    // cached paths through the old nodes would refer to nodes that are
+    // reused below
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (size_t i = 0; i < cache.size(); ) {
+            const CachedPath &c = cache[i];
+            bool stale = rebuild[c.start_cluster] || rebuild[c.goal_cluster];
+            for (size_t j = 0; j < c.nodes.size() && !stale; ++j)
+                stale = rebuild[nodes[c.nodes[j]].cluster] != 0;
+            if (stale) {
+                cache[i] = cache.back();
+                cache.pop_back();
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    for (int c = 0; c < num_clusters; ++c) {
+        if (!rebuild[c])
+            continue;
+        for (int n : cluster_nodes[c]) {
+            cell_node[nodes[n].cell] = -1;
+            nodes[n].cluster = -1;
+            nodes[n].edges.clear();
+            free_nodes.push_back(n);
+        }
+        cluster_nodes[c].clear();
+    }
+    for (int c = 0; c < num_clusters; ++c) {
+        if (rebuild[c])
+            continue;
+        for (int n : cluster_nodes[c]) {
+            std::vector<Edge> &edges = nodes[n].edges;
+            for (size_t i = 0; i < edges.size(); ) {
+                if (nodes[edges[i].to].cluster < 0) {
+                    edges[i] = edges.back();
+                    edges.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+        }
+    }
+
+    // borders between clusters side by side, then above each other
+    for (int cx = 1; cx < clusters_x; ++cx) {
+        int x = cx * cluster_size;
+        for (int cy = 0; cy < clusters_y; ++cy) {
+            int right = cy * clusters_x + cx;
+            if (!rebuild[right - 1] && !rebuild[right])
+                continue;
+            int y0 = cy * cluster_size;
+            int y1 = std::min(y0 + cluster_size, g.height);
+            add_entrances(y0 * g.width + x - 1, y0 * g.width + x, g.width, y1 - y0);
+        }
+    }
+    for (int cy = 1; cy < clusters_y; ++cy) {
+        int y = cy * cluster_size;
+        for (int cx = 0; cx < clusters_x; ++cx) {
+            int above = cy * clusters_x + cx;
+            if (!rebuild[above - clusters_x] && !rebuild[above])
+                continue;
+            int x0 = cx * cluster_size;
+            int x1 = std::min(x0 + cluster_size, g.width);
+            add_entrances((y - 1) * g.width + x0, y * g.width + x0, 1, x1 - x0);
+        }
+    }
+
+    std::vector<float> dist;
+    for (int c = 0; c < num_clusters; ++c) {
+        if (!rebuild[c])
+            continue;
+        Bounds b = cluster_bounds(c);
+        for (int from : cluster_nodes[c]) {
+            search_cluster(c, nodes[from].cell, -1, dist, nullptr);
+            for (int to : cluster_nodes[c]) {
+                int cell = nodes[to].cell;
+                float d = dist[b.local(cell % g.width, cell / g.width)];
+                if (to != from && d < FLT_MAX) {
+                    Edge e = { to, d };
+                    nodes[from].edges.push_back(e);
+                }
+            }
+        }
+    }
+}
+
+int PathFinder::node_at_cell(int cell) {
+    if (cell_node[cell] < 0) {
+        int n;
+        if (free_nodes.empty()) {
+            n = (int)nodes.size();
+            nodes.push_back(Node());
+        } else {
+            n = free_nodes.back();
+            free_nodes.pop_back();
+        }
+        nodes[n].cell = cell;
+        nodes[n].cluster = cluster_of(cell);
+        cell_node[cell] = n;
+        cluster_nodes[nodes[n].cluster].push_back(n);
+    }
+    return cell_node[cell];
+}
+
+// cells a0 + i*step and b0 + i*step for i in [0, length) face each other
+// across a border
+void PathFinder::add_entrances(int a0, int b0, int step, int length) {
+    const std::vector<unsigned char> &blocked = obstacles.blocked();
+    float cost = obstacles.grid().cell_size;
+
+    int run_start = -1;
+    for (int i = 0; i <= length; ++i) {
+        bool open = i < length && !blocked[a0 + i * step] && !blocked[b0 + i * step];
+        if (open && run_start < 0)
+            run_start = i;
+        if (open || run_start < 0)
+            continue;
+
+        int run_end = i;
+        int picks[2];
+        int num_picks = 0;
+        if (run_end - run_start < MAX_SINGLE_ENTRANCE) {
+            picks[num_picks++] = (run_start + run_end - 1) / 2;
+        } else {
+            picks[num_picks++] = run_start;
+            picks[num_picks++] = run_end - 1;
+        }
+        for (int p = 0; p < num_picks; ++p) {
+            int a = node_at_cell(a0 + picks[p] * step);
+            int b = node_at_cell(b0 + picks[p] * step);
+            Edge ab = { b, cost };
+            Edge ba = { a, cost };
+            nodes[a].edges.push_back(ab);
+            nodes[b].edges.push_back(ba);
+        }
+        run_start = -1;
+    }
+}
+
+// A* from cell from to cell to without leaving the cluster, or Dijkstra to
+// every cell of it if to < 0. dist gets the distances to the cells of the
+// cluster that were reached, indexed by Bounds::local. Returns the
+// distance to to, FLT_MAX if it can't be reached.
+float PathFinder::search_cluster(int cluster, int from, int to, std::vector<float> &dist,
+                                 std::vector<int> *path) const
+{
+    const NavGrid &g = obstacles.grid();
+    const std::vector<unsigned char> &blocked = obstacles.blocked();
+    const float cost[2] = { g.cell_size, g.cell_size * sqrtf(2.0f) };
+
+    Bounds b = cluster_bounds(cluster);
+    int area = b.width() * (b.y1 - b.y0);
+    dist.assign(area, FLT_MAX);
+    std::vector<signed char> came(area, -1); // direction each cell was reached in
+    std::vector<unsigned char> closed(area, 0);
+    std::vector<QueueItem> queue;
+
+    dist[b.local(from % g.width, from / g.width)] = 0;
+    push(queue, to >= 0 ? octile(g, from, to) : 0, from);
+
+    while (!queue.empty()) {
+        int cell = pop(queue).second;
+        int x = cell % g.width, y = cell / g.width;
+        int l = b.local(x, y);
+        if (closed[l])
+            continue;
+        closed[l] = 1;
+        if (cell == to)
+            break;
+
+        for (int d = 0; d < 8; ++d) {
+            int nx = x + NavGrid::dir_x[d], ny = y + NavGrid::dir_y[d];
+            if (nx < b.x0 || ny < b.y0 || nx >= b.x1 || ny >= b.y1)
+                continue;
+            int n = ny * g.width + nx;
+            if (blocked[n])
+                continue;
+            if ((d & 1) && (blocked[y * g.width + nx] || blocked[ny * g.width + x]))
+                continue; // don't cut corners
+            int nl = b.local(nx, ny);
+            float nd = dist[l] + cost[d & 1];
+            if (nd < dist[nl]) {
+                dist[nl] = nd;
+                came[nl] = (signed char)d;
+                push(queue, to >= 0 ? nd + octile(g, n, to) : nd, n);
+            }
+        }
+    }
+
+    if (to < 0)
+        return 0;
+    float result = dist[b.local(to % g.width, to / g.width)];
+    if (path && result < FLT_MAX) {
+        path->clear();
+        for (int cell = to; cell != from; ) {
+            path->push_back(cell);
+            int d = came[b.local(cell % g.width, cell / g.width)];
+            cell -= NavGrid::dir_y[d] * g.width + NavGrid::dir_x[d];
+        }
+        path->push_back(from);
+        std::reverse(path->begin(), path->end());
+    }
+    return result;
+}
+
+// A* over the nodes, from the nodes of the start cluster to those of the
+// goal cluster, with the distances from start and to goal inside them
+bool PathFinder::search_nodes(int start, int goal, std::vector<int> &result) const {
+    const NavGrid &g = obstacles.grid();
+    int start_cluster = cluster_of(start);
+    int goal_cluster = cluster_of(goal);
+    Bounds sb = cluster_bounds(start_cluster);
+    Bounds gb = cluster_bounds(goal_cluster);
+
+    std::vector<float> start_dist, goal_dist;
+    search_cluster(start_cluster, start, -1, start_dist, nullptr);
+    search_cluster(goal_cluster, goal, -1, goal_dist, nullptr);
+
+    // the goal itself is one past the last node
+    const int GOAL = (int)nodes.size();
+    std::vector<float> dist(nodes.size() + 1, FLT_MAX);
+    std::vector<int> parent(nodes.size() + 1, -1);
+    std::vector<unsigned char> closed(nodes.size() + 1, 0);
+    std::vector<QueueItem> queue;
+
+    for (int n : cluster_nodes[start_cluster]) {
+        int cell = nodes[n].cell;
+        float d = start_dist[sb.local(cell % g.width, cell / g.width)];
+        if (d < FLT_MAX) {
+            dist[n] = d;
+            push(queue, d + octile(g, cell, goal), n);
+        }
+    }
+
+    while (!queue.empty()) {
+        int n = pop(queue).second;
+        if (closed[n])
+            continue;
+        closed[n] = 1;
+        if (n == GOAL)
+            break;
+
+        const Node &node = nodes[n];
+        if (node.cluster == goal_cluster) {
+            float d = goal_dist[gb.local(node.cell % g.width, node.cell / g.width)];
+            if (d < FLT_MAX && dist[n] + d < dist[GOAL]) {
+                dist[GOAL] = dist[n] + d;
+                parent[GOAL] = n;
+                push(queue, dist[GOAL], GOAL);
+            }
+        }
+        for (const Edge &e : node.edges) {
+            float nd = dist[n] + e.cost;
+            if (nd < dist[e.to]) {
+                dist[e.to] = nd;
+                parent[e.to] = n;
+                push(queue, nd + octile(g, nodes[e.to].cell, goal), e.to);
+            }
+        }
+    }
+
+    if (dist[GOAL] == FLT_MAX)
+        return false;
+    result.clear();
+    for (int n = parent[GOAL]; n >= 0; n = parent[n])
+        result.push_back(n);
+    std::reverse(result.begin(), result.end());
+    return true;
+}
+
+// the cells from start through the nodes to goal
+bool PathFinder::refine(int start, int goal, const std::vector<int> &path_nodes,
+                        std::vector<int> &cells) const
+{
+    std::vector<float> dist;
+    std::vector<int> part;
+
+    const Node &first = nodes[path_nodes.front()];
+    if (search_cluster(cluster_of(start), start, first.cell, dist, &cells) == FLT_MAX)
+        return false;
+
+    for (size_t i = 1; i < path_nodes.size(); ++i) {
+        const Node &a = nodes[path_nodes[i - 1]];
+        const Node &b = nodes[path_nodes[i]];
+        if (a.cluster != b.cluster) {
+            cells.push_back(b.cell); // across a border
+            continue;
+        }
+        if (search_cluster(a.cluster, a.cell, b.cell, dist, &part) == FLT_MAX)
+            return false;
+        cells.insert(cells.end(), part.begin() + 1, part.end());
+    }
+
+    const Node &last = nodes[path_nodes.back()];
+    if (search_cluster(cluster_of(goal), last.cell, goal, dist, &part) == FLT_MAX)
+        return false;
+    cells.insert(cells.end(), part.begin() + 1, part.end());
+    return true;
+}
+
+// whether the straight line between the centers of two cells stays in
+// free cells, sampled at a quarter of the cell size
+bool PathFinder::line_of_sight(int a, int b) const {
+    const NavGrid &g = obstacles.grid();
+    vec3 p0 = g.cell_center(a);
+    vec3 p1 = g.cell_center(b);
+    int steps = (int)ceilf(glm::length(p1 - p0) * g.inv_cell_size * 4.0f);
+    for (int i = 1; i < steps; ++i) {
+        vec3 p = glm::mix(p0, p1, (float)i / (float)steps);
+        int cell = g.cell_at(p.x, p.y);
+        if (cell < 0 || obstacles.blocked()[cell])
+            return false;
+    }
+    return true;
+}
+
+bool PathFinder::find_cached(int start_cluster, int goal_cluster, std::vector<int> &path_nodes) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    ++clock;
+    for (CachedPath &c : cache) {
+        if (c.start_cluster == start_cluster && c.goal_cluster == goal_cluster) {
+            c.last_used = clock;
+            path_nodes = c.nodes;
+            ++_stats.cache_hits;
+            return true;
+        }
+    }
+    ++_stats.cache_misses;
+    return false;
+}
+
+void PathFinder::add_cached(int start_cluster, int goal_cluster, const std::vector<int> &path_nodes) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    ++clock;
+
+    CachedPath *c = nullptr;
+    for (CachedPath &existing : cache) {
+        if (existing.start_cluster == start_cluster && existing.goal_cluster == goal_cluster)
+            c = &existing; // found by another thread meanwhile
+    }
+    if (!c && (int)cache.size() < cache_size) {
+        cache.push_back(CachedPath());
+        c = &cache.back();
+    }
+    if (!c) {
+        c = &cache[0];
+        for (CachedPath &existing : cache) {
+            if (existing.last_used < c->last_used)
+                c = &existing;
+        }
+    }
+
+    c->start_cluster = start_cluster;
+    c->goal_cluster = goal_cluster;
+    c->nodes = path_nodes;
+    c->last_used = clock;
+}
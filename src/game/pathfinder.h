@@ -0,0 +1,190 @@
+#ifndef PATHFINDER_H
+#define PATHFINDER_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "util/mymath.h"
+#include "game/navgrid.h"
+
+// A path asked of a PathFinder. It belongs to whoever asked, and has to be
+// cancelled if it goes away while pending. The owner sets it back to IDLE,
+// or cancels it, once done with it.
+struct PathRequest {
+    enum State {
+        IDLE,
+        PENDING,
+        DONE,
+        FAILED
+    };
+
+    State state;
+    vec3 start;
+    vec3 goal;
+    std::vector<vec3> waypoints; // after start, ending at goal, when DONE
+
+    PathRequest() : state(IDLE) {}
+};
+
+// Hierarchical pathfinding (HPA*) around round obstacles on a grid.
+//
+// The grid is split into square clusters. Each stretch of free cells along
+// the border of two clusters is an entrance, with a node on either side.
+// Nodes in the same cluster are connected by the length of the shortest
+// path between them inside the cluster. To find a path, start and goal
+// are connected to the nodes of their clusters and the graph of nodes is
+// searched with A*, then each step is refined into cells with A* inside a
+// single cluster, and the cells are reduced to the waypoints needed to
+// keep line of sight.
+//
+// The node sequences are cached by start and goal cluster, and reused for
+// any start and goal in the same clusters. When the obstacles change, only
+// the clusters with changed cells and their neighbors are rebuilt, and
+// only the cached paths that start, end or pass in those are dropped.
+class PathFinder {
+public:
+    struct Stats {
+        int cache_hits;
+        int cache_misses;
+    };
+
+    PathFinder(float x0, float y0, float x1, float y1, float cell_size,
+               int cluster_size, int cache_size);
+    ~PathFinder();
+
+    // block the cells with centers within radius of each obstacle added
+    // in between; the graph is rebuilt around the clusters where any cell
+    // changed, and then end_obstacles() returns true, as paths found
+    // before may be blocked. end_obstacles() waits for the search running
+    // in the background, if any, and starts a new generation of the graph.
+    void begin_obstacles();
+    void add_obstacle(vec3 pos, float radius);
+    bool end_obstacles();
+
+    // whether the straight lines from from through waypoints[next] on
+    // cross a cluster changed by the last end_obstacles() that returned
+    // true, so that a path found before may no longer be the way
+    bool crosses_changes(vec3 from, const std::vector<vec3> &waypoints, size_t next) const;
+
+    // find a path now; can be called from several threads at once, but
+    // not while the obstacles are being changed
+    bool find_path(vec3 start, vec3 goal, std::vector<vec3> &waypoints);
+
+    // queue a request for service(); asking again for a pending request
+    // drops the search already issued for it
+    void request(PathRequest *r, vec3 start, vec3 goal);
+    void cancel(PathRequest *r);
+
+    // Hand the results of the searches finished since the last call to
+    // their requests, then issue queued requests, in the order they were
+    // asked for, to a thread that searches in the background while the
+    // caller goes on. This doesn't wait for any search. A result found on
+    // a graph that end_obstacles() has rebuilt since is dropped and its
+    // request issued again; that of a cancelled request is ignored.
+    // budget bounds the work issued: requests are issued while the
+    // searches not finished yet are estimated, by the average time of the
+    // last ones, to take less than budget seconds, so a call issues at
+    // most budget seconds of searches, or one search if none is left
+    // unfinished.
+    void service(float budget);
+
+    Stats stats() const;
+
+private:
+    // non-copyable
+    PathFinder(const PathFinder &);
+    PathFinder &operator=(const PathFinder &);
+
+    struct Edge {
+        int to;
+        float cost;
+    };
+
+    struct Node {
+        int cell;
+        int cluster;
+        std::vector<Edge> edges;
+    };
+
+    // a search issued to the background thread. request is only touched
+    // by the thread calling service(); found, generation and waypoints are
+    // written by the background thread before it sets done. cancelled and
+    // done are under job_mutex.
+    struct Job {
+        PathRequest *request; // null once cancelled
+        vec3 start, goal;
+        bool cancelled;
+        bool done;
+        bool found;
+        unsigned int generation; // of the graph searched
+        std::vector<vec3> waypoints;
+    };
+
+    struct CachedPath {
+        int start_cluster;
+        int goal_cluster;
+        std::vector<int> nodes;
+        unsigned int last_used;
+    };
+
+    // cell ranges [x0, x1) and [y0, y1) of a cluster
+    struct Bounds {
+        int x0, y0, x1, y1;
+        int width() const { return x1 - x0; }
+        int local(int x, int y) const { return (y - y0) * width() + (x - x0); }
+    };
+
+    int cluster_of(int cell) const;
+    Bounds cluster_bounds(int cluster) const;
+
+    void build_graph(const std::vector<unsigned char> &rebuild);
+    int node_at_cell(int cell);
+    void add_entrances(int a0, int b0, int step, int length);
+
+    float search_cluster(int cluster, int from, int to, std::vector<float> &dist,
+                         std::vector<int> *path) const;
+    bool search_nodes(int start, int goal, std::vector<int> &result) const;
+    bool refine(int start, int goal, const std::vector<int> &path_nodes, std::vector<int> &cells) const;
+    bool line_of_sight(int a, int b) const;
+
+    bool find_cells(int start, int goal, std::vector<int> &cells);
+
+    void worker_main();
+
+    bool find_cached(int start_cluster, int goal_cluster, std::vector<int> &path_nodes);
+    void add_cached(int start_cluster, int goal_cluster, const std::vector<int> &path_nodes);
+
+    ObstacleMap obstacles;
+    int cluster_size;
+    int clusters_x, clusters_y;
+
+    std::vector<Node> nodes; // cluster -1 for the ones in free_nodes
+    std::vector<int> free_nodes;
+    std::vector<int> cell_node; // node at each cell, or -1
+    std::vector<std::vector<int> > cluster_nodes;
+    std::vector<unsigned char> changed_clusters;
+
+    mutable std::mutex cache_mutex;
+    std::vector<CachedPath> cache;
+    int cache_size;
+    unsigned int clock;
+    Stats _stats;
+
+    std::mutex graph_mutex; // held while searching in the background or rebuilding
+    unsigned int generation;
+
+    std::vector<PathRequest *> pending; // not issued yet
+    std::vector<Job *> issued;          // not collected yet, in the order issued
+
+    std::mutex job_mutex;
+    std::condition_variable job_cond;
+    std::deque<Job *> queue; // issued and not started
+    float search_time;       // running average of the searches, in seconds
+    bool quit;
+    std::thread worker;
+};
+
+
+#endif
@@ -4,7 +4,11 @@
 
 enum {
     SPLIT_THRESHOLD = 3,
-    MERGE_THRESHOLD = 1
+    MERGE_THRESHOLD = 1,
+
+    // batched updates merge siblings once they hold this many objects or
+    // fewer, leaving a gap to SPLIT_THRESHOLD
+    BATCH_MERGE_THRESHOLD = 2
 };
 
 
@@ -32,7 +36,7 @@ void QuadTree::Object::qtree_update() {
 
 
 
-QuadTree::QuadTree(float x0, float y0, float x1, float y1, int max_depth) : max_depth(max_depth) {
+QuadTree::QuadTree(float x0, float y0, float x1, float y1, int max_depth) : max_depth(max_depth), batching(false) {
     root = new_node(nullptr, x0, y0, x1, y1);
 }
 
@@ -46,30 +50,18 @@ void QuadTree::insert(Node *n, Object *obj) {
 
     if (!n->child[0]) {
         // we are a leaf node; check if there is space
-        if (n->num_objects < SPLIT_THRESHOLD || n->depth == max_depth) {
+        // (while batching, leaves are allowed to overflow until end_batch)
+        if (n->num_objects < SPLIT_THRESHOLD || n->depth == max_depth || batching) {
             obj->qtree_node = n;
             n->objects.push_back(obj);
             ++n->num_objects;
+            if (batching)
+                mark_dirty(n);
             return;
         }
 
         // this node is full; split into four children
-        float w = (n->x1 - n->x0) * 0.5f;
-        float h = (n->y1 - n->y0) * 0.5f;
-        n->child[0] = new_node(n, n->x0, n->y0, n->x0 + w, n->y0 + h);
-        n->child[1] = new_node(n, n->x0 + w, n->y0, n->x1, n->y0 + h);
-        n->child[2] = new_node(n, n->x0, n->y0 + h, n->x0 + w, n->y1);
-        n->child[3] = new_node(n, n->x0 + w, n->y0 + h, n->x1, n->y1);
-
-        // spread objects among children
-        while (n->num_objects) {
-            Object *obj2 = n->objects.front();
-            n->remove(obj2);
-            float x, y;
-            obj2->qtree_position(x, y);
-            insert(n->calc_child(x, y), obj2);
-        }
-        assert(n->objects.empty());
+        split(n);
     }
 
     // this is an internal node, so we recurse
@@ -78,6 +70,27 @@ void QuadTree::insert(Node *n, Object *obj) {
     insert(n->calc_child(x, y), obj);
 }
 
+void QuadTree::split(Node *n) {
+    assert(!n->child[0]);
+
+    float w = (n->x1 - n->x0) * 0.5f;
+    float h = (n->y1 - n->y0) * 0.5f;
+    n->child[0] = new_node(n, n->x0, n->y0, n->x0 + w, n->y0 + h);
+    n->child[1] = new_node(n, n->x0 + w, n->y0, n->x1, n->y0 + h);
+    n->child[2] = new_node(n, n->x0, n->y0 + h, n->x0 + w, n->y1);
+    n->child[3] = new_node(n, n->x0 + w, n->y0 + h, n->x1, n->y1);
+
+    // spread objects among children
+    while (n->num_objects) {
+        Object *obj = n->objects.front();
+        n->remove(obj);
+        float x, y;
+        obj->qtree_position(x, y);
+        insert(n->calc_child(x, y), obj);
+    }
+    assert(n->objects.empty());
+}
+
 void QuadTree::remove(Object *obj) {
     Node *n = obj->qtree_node;
     if (!n)
@@ -86,6 +99,11 @@ void QuadTree::remove(Object *obj) {
     assert(!n->child[0]);
 
     n->remove(obj);
+
+    if (batching) {
+        mark_dirty(n);
+        return;
+    }
     
     // only when a removal leaves the count below or at MERGE_THRESHOLD do we
     // investigate merging the node with its siblings
@@ -138,6 +156,67 @@ void QuadTree::maybe_merge_with_siblings(Node *n) {
     maybe_merge_with_siblings(parent);
 }
 
+void QuadTree::begin_batch() {
+    assert(!batching);
+    batching = true;
+}
+
+void QuadTree::end_batch() {
+    assert(batching);
+    rebalance(root);
+    batching = false;
+}
+
+void QuadTree::mark_dirty(Node *n) {
+    // if a node is dirty, so are all of its ancestors
+    while (n && !n->dirty) {
+        n->dirty = true;
+        n = n->parent;
+    }
+}
+
+void QuadTree::rebalance(Node *n) {
+    if (!n->dirty)
+        return;
+
+    if (!n->child[0]) {
+        if (n->num_objects > SPLIT_THRESHOLD && n->depth < max_depth) {
+            // the new children come out dirty, so they are visited below and
+            // split further if necessary
+            split(n);
+        }
+    }
+
+    if (n->child[0]) {
+        int count = 0;
+        bool all_leaves = true;
+        for (int i = 0; i < 4; ++i) {
+            rebalance(n->child[i]);
+            count += n->child[i]->num_objects;
+            if (n->child[i]->child[0])
+                all_leaves = false;
+        }
+
+        if (all_leaves && count <= BATCH_MERGE_THRESHOLD) {
+            // pull the objects of the children up into this node
+            for (int i = 0; i < 4; ++i) {
+                Node *c = n->child[i];
+                n->child[i] = nullptr;
+                while (c->num_objects) {
+                    Object *obj = c->objects.front();
+                    c->remove(obj);
+                    obj->qtree_node = n;
+                    n->objects.push_back(obj);
+                    ++n->num_objects;
+                }
+                free_node(c);
+            }
+        }
+    }
+
+    n->dirty = false;
+}
+
 QuadTree::Node *QuadTree::new_node(Node *parent, float x0, float y0, float x1, float y1) {
     Node *n = pool.create();
     n->x0 = x0;
@@ -149,6 +228,7 @@ QuadTree::Node *QuadTree::new_node(Node *parent, float x0, float y0, float x1, f
     n->qtree = this;
     n->parent = parent;
     n->depth = parent ? parent->depth + 1 : 0;
+    n->dirty = false;
     n->child[0] = nullptr;
     n->child[1] = nullptr;
     n->child[2] = nullptr;
@@ -30,11 +30,27 @@ public:
     void insert(Object *obj);
     void remove(Object *obj);
 
+    // Between begin_batch() and end_batch(), objects that are inserted,
+    // removed or moved are only re-binned into the right leaf; splitting and
+    // merging is deferred to end_batch(), which rebalances all touched nodes
+    // in a single pass. Merging uses a lower threshold than splitting, so
+    // objects moving back and forth over a boundary don't cause a split and
+    // a merge every frame.
+    void begin_batch();
+    void end_batch();
+
     template <class Func>
     void query(float x0, float y0, float x1, float y1, Func func) {
         root->query(x0, y0, x1, y1, func);
     }
 
+    // describe the tree to a SpatialSnapshot; add(obj) is called for every
+    // object and has to add it to the builder
+    template <class Builder, class Func>
+    void flatten(Builder &builder, Func add) {
+        root->flatten(builder, add);
+    }
+
     template <class Func>
     void gather_outlines(Func func) {
         // generate the outside edges of the root:
@@ -56,6 +72,7 @@ private:
         QuadTree *qtree;
         Node *parent;
         int depth;
+        bool dirty; // needs rebalancing at the end of the batch
 
         Node *child[4];
 
@@ -96,6 +113,19 @@ private:
             }
         }
 
+        template <class Builder, class Func>
+        void flatten(Builder &builder, Func add) {
+            builder.open_node();
+            if (child[0]) {
+                for (int i = 0; i < 4; ++i)
+                    child[i]->flatten(builder, add);
+            } else {
+                for (Object *obj : objects)
+                    add(obj);
+            }
+            builder.close_node();
+        }
+
         template <class Func>
         void gather_crosses(Func func) {
             if (!child[0])
@@ -114,7 +144,10 @@ private:
     QuadTree &operator=(const QuadTree &);
 
     void insert(Node *n, Object *obj);
+    void split(Node *n);
     void maybe_merge_with_siblings(Node *n);
+    void mark_dirty(Node *n);
+    void rebalance(Node *n);
 
     Node *new_node(Node *parent, float x0, float y0, float x1, float y1);
     void free_node(Node *n);
@@ -122,6 +155,7 @@ private:
     Pool<Node> pool;
     int max_depth;
     Node *root;
+    bool batching;
 };
 
 
@@ -0,0 +1,75 @@
+#include "game/spatialgrid.h"
+#include <cmath>
+#include <algorithm>
+
+
+SpatialGrid::SpatialGrid(float x0, float y0, float x1, float y1, float cell_size) :
+    x0(x0), y0(y0), _cell_size(cell_size), inv_cell_size(1.0f / cell_size)
+{
+    assert(cell_size > 0);
+    width = std::max(1, (int)ceilf((x1 - x0) * inv_cell_size));
+    height = std::max(1, (int)ceilf((y1 - y0) * inv_cell_size));
+    cell_start.assign(width * height + 1, 0);
+}
+
+void SpatialGrid::insert(Object *obj) {
+    objects.push_back(obj);
+}
+
+// removal is rare (only when a body dies), so a linear search is fine here
+void SpatialGrid::remove(Object *obj) {
+    auto it = std::find(objects.begin(), objects.end(), obj);
+    if (it == objects.end())
+        return;
+    *it = objects.back();
+    objects.pop_back();
+
+    // the entries must not reference it until the next rebuild
+    for (Entry &e : entries) {
+        if (e.obj == obj) {
+            e.obj = nullptr;
+            break;
+        }
+    }
+}
+
+void SpatialGrid::rebuild() {
+    int num_cells = width * height;
+    int num_objects = (int)objects.size();
+
+    unsorted.resize(num_objects);
+    entries.resize(num_objects);
+    entry_cell.resize(num_objects);
+    std::fill(cell_start.begin(), cell_start.end(), 0);
+
+    // fetch positions and count objects per cell; the counts are stored one
+    // slot ahead, so that the prefix sum below turns them into start offsets
+    for (int i = 0; i < num_objects; ++i) {
+        Entry &e = unsorted[i];
+        e.obj = objects[i];
+        e.obj->qtree_position(e.x, e.y);
+        int cx, cy;
+        calc_cell(e.x, e.y, cx, cy);
+        int cell = cy * width + cx;
+        entry_cell[i] = cell;
+        ++cell_start[cell + 1];
+    }
+
+    for (int c = 0; c < num_cells; ++c)
+        cell_start[c + 1] += cell_start[c];
+
+    // scatter the objects into their cells, using cell_start as insertion
+    // cursors; afterwards every cursor has advanced to the start of the
+    // next cell, so shifting them back by one slot restores the offsets
+    for (int i = 0; i < num_objects; ++i)
+        entries[cell_start[entry_cell[i]]++] = unsorted[i];
+
+    for (int c = num_cells; c > 0; --c)
+        cell_start[c] = cell_start[c - 1];
+    cell_start[0] = 0;
+
+    // keep the object list in cell order too, so the next rebuild walks the
+    // objects in roughly the same order they end up in
+    for (int i = 0; i < num_objects; ++i)
+        objects[i] = entries[i].obj;
+}
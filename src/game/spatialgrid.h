@@ -0,0 +1,131 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include <vector>
+#include "game/quadtree.h"
+
+// Uniform grid over the XY plane, rebuilt from scratch every frame.
+// Works best when objects have similar extents and the query radius is
+// close to the cell size, e.g. ship swarms.
+//
+// Objects use the same interface as QuadTree, so the two can be swapped.
+// Unlike QuadTree, moving an object has no effect until the next rebuild(),
+// which bins all objects with a counting sort: entries are stored
+// contiguously ordered by cell, and each cell is a [start, end) range into
+// them. Positions are copied into the entries, so queries that only look at
+// the entry coordinates never touch the objects themselves.
+class SpatialGrid {
+public:
+    typedef QuadTree::Object Object;
+
+    struct Entry {
+        float x, y;
+        Object *obj; // nullptr if removed since the last rebuild
+    };
+
+    SpatialGrid(float x0, float y0, float x1, float y1, float cell_size);
+
+    void insert(Object *obj);
+    void remove(Object *obj);
+
+    // re-bin all objects at their current positions
+    void rebuild();
+
+    float cell_size() { return _cell_size; }
+
+    // visit objects in all cells overlapping the given rectangle
+    template <class Func>
+    void query(float x0, float y0, float x1, float y1, Func func) {
+        int cx0, cy0, cx1, cy1;
+        calc_cell(x0, y0, cx0, cy0);
+        calc_cell(x1, y1, cx1, cy1);
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            for (int cx = cx0; cx <= cx1; ++cx)
+                visit_cell(cy * width + cx, func);
+        }
+    }
+
+    // visit objects in the cell containing (x, y) and its eight neighbors;
+    // covers everything within cell_size() of the point
+    template <class Func>
+    void query_neighbors(float x, float y, Func func) {
+        int cx, cy;
+        calc_cell(x, y, cx, cy);
+        int cx0 = cx > 0 ? cx - 1 : 0;
+        int cy0 = cy > 0 ? cy - 1 : 0;
+        int cx1 = cx < width - 1 ? cx + 1 : cx;
+        int cy1 = cy < height - 1 ? cy + 1 : cy;
+        for (cy = cy0; cy <= cy1; ++cy) {
+            for (cx = cx0; cx <= cx1; ++cx)
+                visit_cell(cy * width + cx, func);
+        }
+    }
+
+    // describe the grid to a SpatialSnapshot as root -> rows -> cells;
+    // add(obj) is called for every object and has to add it to the builder
+    template <class Builder, class Func>
+    void flatten(Builder &builder, Func add) {
+        builder.open_node();
+        for (int cy = 0; cy < height; ++cy) {
+            builder.open_node();
+            for (int cx = 0; cx < width; ++cx) {
+                int cell = cy * width + cx;
+                if (cell_start[cell] == cell_start[cell + 1])
+                    continue;
+                builder.open_node();
+                visit_cell(cell, add);
+                builder.close_node();
+            }
+            builder.close_node();
+        }
+        builder.close_node();
+    }
+
+    template <class Func>
+    void gather_outlines(Func func) {
+        for (int i = 0; i <= width; ++i) {
+            func(x0 + i * _cell_size, y0);
+            func(x0 + i * _cell_size, y0 + height * _cell_size);
+        }
+        for (int i = 0; i <= height; ++i) {
+            func(x0, y0 + i * _cell_size);
+            func(x0 + width * _cell_size, y0 + i * _cell_size);
+        }
+    }
+
+private:
+    // non-copyable
+    SpatialGrid(const SpatialGrid &);
+    SpatialGrid &operator=(const SpatialGrid &);
+
+    // positions outside the grid are clamped to the border cells
+    void calc_cell(float x, float y, int &cx, int &cy) {
+        cx = (int)((x - x0) * inv_cell_size);
+        cy = (int)((y - y0) * inv_cell_size);
+        if (x < x0) cx = 0; else if (cx >= width) cx = width - 1;
+        if (y < y0) cy = 0; else if (cy >= height) cy = height - 1;
+    }
+
+    template <class Func>
+    void visit_cell(int cell, Func func) {
+        for (int i = cell_start[cell]; i < cell_start[cell + 1]; ++i) {
+            if (entries[i].obj)
+                func(entries[i].obj);
+        }
+    }
+
+    float x0, y0;
+    float _cell_size, inv_cell_size;
+    int width, height;
+
+    std::vector<Object *> objects;
+    std::vector<Entry> entries;   // sorted by cell
+    std::vector<int> cell_start;  // width*height + 1 offsets into entries
+
+    // scratch space for rebuild()
+    std::vector<Entry> unsorted;
+    std::vector<int> entry_cell;
+};
+
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef SPATIALSNAPSHOT_H
+#define SPATIALSNAPSHOT_H
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cassert>
+#include <cmath>
+#include "util/mymath.h"
+#include "util/frustum.h"
+
+// Read-only copy of a spatial index and the state of the objects in it,
+// taken once per frame. All queries are const and never touch the objects
+// themselves, so any number of threads can query a snapshot while the live
+// index and objects are being updated.
+//
+// A snapshot keeps the structure of the index it was taken from: the index
+// describes itself through open_node()/add()/close_node() (see the
+// flatten() methods of QuadTree, Octree, PackedQuadTree and SpatialGrid),
+// and the nodes are stored depth first in one array. Every node gets a
+// bounding box around everything below it, including object radii.
+template <class T>
+class SpatialSnapshot {
+public:
+    struct Entry {
+        vec3 pos;
+        vec3 vel;
+        float radius;
+        T *obj;
+    };
+
+    SpatialSnapshot() {}
+
+    void clear() {
+        nodes.clear();
+        entries.clear();
+        open_nodes.clear();
+    }
+
+    int size() const { return (int)entries.size(); }
+
+    // building; objects can only be added to nodes without children
+    void open_node() {
+        if (!open_nodes.empty())
+            finish_entries(nodes[open_nodes.back()]);
+        open_nodes.push_back((int)nodes.size());
+        Node n;
+        n.first_entry = (int)entries.size();
+        n.num_entries = -1;
+        nodes.push_back(n);
+    }
+
+    void add(T *obj, vec3 pos, vec3 vel, float radius) {
+        assert(!open_nodes.empty());
+        assert(nodes[open_nodes.back()].num_entries == -1);
+        assert(open_nodes.back() == (int)nodes.size() - 1);
+        Entry e;
+        e.pos = pos;
+        e.vel = vel;
+        e.radius = radius;
+        e.obj = obj;
+        entries.push_back(e);
+    }
+
+    void close_node() {
+        int index = open_nodes.back();
+        open_nodes.pop_back();
+        Node &n = nodes[index];
+        finish_entries(n);
+
+        n.min = vec3(FLT_MAX);
+        n.max = vec3(-FLT_MAX);
+        for (int i = n.first_entry; i < n.first_entry + n.num_entries; ++i) {
+            n.min = glm::min(n.min, entries[i].pos - entries[i].radius);
+            n.max = glm::max(n.max, entries[i].pos + entries[i].radius);
+        }
+        int end = (int)nodes.size();
+        for (int c = index + 1; c < end; c = nodes[c].skip) {
+            n.min = glm::min(n.min, nodes[c].min);
+            n.max = glm::max(n.max, nodes[c].max);
+        }
+
+        // drop empty leaves, except for the root
+        if (index > 0 && index + 1 == end && n.num_entries == 0) {
+            nodes.pop_back();
+            return;
+        }
+        n.skip = end;
+    }
+
+    // visit entries whose position is within radius of center
+    template <class Func>
+    void query(vec3 center, float radius, Func func) const {
+        float radius_squared = radius * radius;
+        traverse(
+            [&](const vec3 &min, const vec3 &max) {
+                vec3 d = glm::max(glm::max(min - center, center - max), vec3(0.0f));
+                return glm::dot(d, d) <= radius_squared;
+            },
+            [&](const Entry &e) {
+                vec3 d = e.pos - center;
+                if (glm::dot(d, d) <= radius_squared)
+                    func(e);
+            });
+    }
+
+    // visit entries inside a rectangle on the XY plane, at any height
+    template <class Func>
+    void query_rect(float x0, float y0, float x1, float y1, Func func) const {
+        traverse(
+            [&](const vec3 &min, const vec3 &max) {
+                return !(min.x > x1 || max.x < x0 || min.y > y1 || max.y < y0);
+            },
+            [&](const Entry &e) {
+                if (e.pos.x >= x0 && e.pos.x <= x1 && e.pos.y >= y0 && e.pos.y <= y1)
+                    func(e);
+            });
+    }
+
+    // visit entries whose bounding sphere touches the frustum; subtrees
+    // that are entirely inside are reported without testing their entries
+    template <class Func>
+    void query_frustum(const Frustum &frustum, Func func) const {
+        int i = 0;
+        int end = (int)nodes.size();
+        while (i < end) {
+            const Node &n = nodes[i];
+            if (n.min.x > n.max.x) {
+                ++i; // empty root
+                continue;
+            }
+            Frustum::Result result = frustum.classify_box(n.min, n.max);
+            if (result == Frustum::OUTSIDE) {
+                i = n.skip;
+            } else if (result == Frustum::INSIDE) {
+                // entries are added depth first, so a subtree's entries
+                // are contiguous
+                int last = n.skip < end ? nodes[n.skip].first_entry : (int)entries.size();
+                for (int e = n.first_entry; e < last; ++e)
+                    func(entries[e]);
+                i = n.skip;
+            } else {
+                for (int e = n.first_entry; e < n.first_entry + n.num_entries; ++e) {
+                    if (frustum.intersects_sphere(entries[e].pos, entries[e].radius))
+                        func(entries[e]);
+                }
+                ++i;
+            }
+        }
+    }
+
+    // the entry whose bounding sphere the ray hits first within max_dist,
+    // or nullptr; dir must be normalized. t gets the distance along the
+    // ray to where it enters the sphere (0 if origin is inside it). The ray
+    // is cut short at every hit, so subtrees behind the closest hit so far
+    // are skipped.
+    const Entry *raycast(vec3 origin, vec3 dir, float max_dist, float &t) const {
+        const Entry *best = nullptr;
+        traverse(
+            [&](const vec3 &min, const vec3 &max) {
+                return ray_hits_box(origin, dir, max_dist, min, max);
+            },
+            [&](const Entry &e) {
+                float hit;
+                if (ray_hits_sphere(origin, dir, e.pos, e.radius, hit) &&
+                    (best ? hit < max_dist : hit <= max_dist))
+                {
+                    best = &e;
+                    max_dist = hit;
+                }
+            });
+        t = max_dist;
+        return best;
+    }
+
+    // same as raycast, along the segment from p0 to p1
+    const Entry *segment_cast(vec3 p0, vec3 p1, float &t) const {
+        vec3 d = p1 - p0;
+        float len = glm::length(d);
+        if (len <= 0.0f)
+            return nullptr;
+        return raycast(p0, d / len, len, t);
+    }
+
+private:
+    struct Node {
+        vec3 min, max;
+        int skip;        // next node that is not a descendant of this one
+        int first_entry; // entries stored in this node
+        int num_entries;
+    };
+
+    void finish_entries(Node &n) {
+        if (n.num_entries == -1)
+            n.num_entries = (int)entries.size() - n.first_entry;
+    }
+
+    static bool ray_hits_box(const vec3 &origin, const vec3 &dir, float max_dist,
+                             const vec3 &min, const vec3 &max) {
+        if (min.x > max.x)
+            return false; // empty node
+        float t0 = 0.0f, t1 = max_dist;
+        for (int i = 0; i < 3; ++i) {
+            if (fabsf(dir[i]) < 1e-8f) {
+                // parallel to this slab
+                if (origin[i] < min[i] || origin[i] > max[i])
+                    return false;
+                continue;
+            }
+            float inv = 1.0f / dir[i];
+            float near_t = (min[i] - origin[i]) * inv;
+            float far_t = (max[i] - origin[i]) * inv;
+            if (near_t > far_t)
+                std::swap(near_t, far_t);
+            t0 = std::max(t0, near_t);
+            t1 = std::min(t1, far_t);
+            if (t0 > t1)
+                return false;
+        }
+        return true;
+    }
+
+    static bool ray_hits_sphere(const vec3 &origin, const vec3 &dir,
+                                const vec3 &center, float radius, float &t) {
+        vec3 oc = center - origin;
+        float b = glm::dot(oc, dir);
+        float c = glm::dot(oc, oc) - radius * radius;
+        if (c <= 0.0f) {
+            t = 0.0f; // starts inside
+            return true;
+        }
+        float disc = b * b - c;
+        if (b < 0.0f || disc < 0.0f)
+            return false;
+        t = b - sqrtf(disc);
+        return true;
+    }
+
+    // stackless depth first traversal; subtrees whose bounds fail the
+    // overlap test are skipped as a whole
+    template <class Overlaps, class Func>
+    void traverse(Overlaps overlaps, Func func) const {
+        int i = 0;
+        int end = (int)nodes.size();
+        while (i < end) {
+            const Node &n = nodes[i];
+            if (!overlaps(n.min, n.max)) {
+                i = n.skip;
+                continue;
+            }
+            for (int e = n.first_entry; e < n.first_entry + n.num_entries; ++e)
+                func(entries[e]);
+            ++i;
+        }
+    }
+
+    std::vector<Node> nodes;
+    std::vector<Entry> entries;
+    std::vector<int> open_nodes;
+};
+
+
+// Two snapshots: the published one, which readers query, and one that is
+// being built. A reader has to be done with a snapshot before the one
+// after the next is built, which holds as long as no reader keeps using a
+// snapshot across a frame boundary.
+template <class T>
+class SnapshotBuffer {
+public:
+    SnapshotBuffer() : front(&buffers[0]) {}
+
+    const SpatialSnapshot<T> &read() const {
+        return *front.load(std::memory_order_acquire);
+    }
+
+    SpatialSnapshot<T> &write() {
+        SpatialSnapshot<T> *f = front.load(std::memory_order_relaxed);
+        return f == &buffers[0] ? buffers[1] : buffers[0];
+    }
+
+    // make the write buffer visible to readers
+    void publish() {
+        front.store(&write(), std::memory_order_release);
+    }
+
+private:
+    // non-copyable
+    SnapshotBuffer(const SnapshotBuffer &);
+    SnapshotBuffer &operator=(const SnapshotBuffer &);
+
+    SpatialSnapshot<T> buffers[2];
+    std::atomic<SpatialSnapshot<T> *> front;
+};
+
+
+#endif
@@ -0,0 +1,164 @@
+#include "game/steering.h"
+#include <cmath>
+#include <cstring>
+
+// STEERING_NO_SIMD forces the scalar kernel, for testing it on x86
+#if defined(STEERING_NO_SIMD)
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define STEERING_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define STEERING_SSE
+#endif
+
+
+vec3 limit(vec3 v, float len) {
+    if (glm::length(v) > len)
+        return glm::normalize(v) * len;
+    return v;
+}
+
+SteeringNeighbors::SteeringNeighbors() : count(0) {
+    // the kernels run over whole SIMD words, so unused slots are read too
+    memset(px, 0, sizeof(px));
+    memset(py, 0, sizeof(py));
+    memset(pz, 0, sizeof(pz));
+    memset(vx, 0, sizeof(vx));
+    memset(vy, 0, sizeof(vy));
+    memset(vz, 0, sizeof(vz));
+    memset(radius, 0, sizeof(radius));
+    memset(flags, 0, sizeof(flags));
+}
+
+
+namespace {
+
+#if defined(STEERING_AVX)
+
+enum { WIDTH = 8 };
+typedef __m256 vfloat;
+inline vfloat vset(float f) { return _mm256_set1_ps(f); }
+inline vfloat vload(const float *p) { return _mm256_loadu_ps(p); }
+inline void vstore(float *p, vfloat v) { _mm256_storeu_ps(p, v); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+
+#elif defined(STEERING_SSE)
+
+enum { WIDTH = 4 };
+typedef __m128 vfloat;
+inline vfloat vset(float f) { return _mm_set1_ps(f); }
+inline vfloat vload(const float *p) { return _mm_loadu_ps(p); }
+inline void vstore(float *p, vfloat v) { _mm_storeu_ps(p, v); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+
+#endif
+
+} // namespace
+
+
+void calc_offsets(vec3 pos, const SteeringNeighbors &n, NeighborOffsets &o) {
+#if defined(STEERING_AVX) || defined(STEERING_SSE)
+    const vfloat x = vset(pos.x), y = vset(pos.y), z = vset(pos.z);
+    const vfloat one = vset(1.0f);
+    for (int i = 0; i < n.count; i += WIDTH) {
+        vfloat dx = vsub(x, vload(&n.px[i]));
+        vfloat dy = vsub(y, vload(&n.py[i]));
+        vfloat dz = vsub(z, vload(&n.pz[i]));
+        vfloat len = vsqrt(vadd(vadd(vmul(dx, dx), vmul(dy, dy)), vmul(dz, dz)));
+        vfloat inv = vdiv(one, len);
+        vstore(&o.dx[i], dx);
+        vstore(&o.dy[i], dy);
+        vstore(&o.dz[i], dz);
+        vstore(&o.len[i], len);
+        vstore(&o.sx[i], vdiv(vmul(dx, inv), len));
+        vstore(&o.sy[i], vdiv(vmul(dy, inv), len));
+        vstore(&o.sz[i], vdiv(vmul(dz, inv), len));
+    }
+#else
+    for (int i = 0; i < n.count; ++i) {
+        float dx = pos.x - n.px[i];
+        float dy = pos.y - n.py[i];
+        float dz = pos.z - n.pz[i];
+        float len = sqrtf(dx*dx + dy*dy + dz*dz);
+        float inv = 1.0f / len;
+        o.dx[i] = dx;
+        o.dy[i] = dy;
+        o.dz[i] = dz;
+        o.len[i] = len;
+        o.sx[i] = (dx * inv) / len;
+        o.sy[i] = (dy * inv) / len;
+        o.sz[i] = (dz * inv) / len;
+    }
+#endif
+}
+
+
+// time of contact within [0, 1] of two moving spheres over dt
+static bool sweep(vec3 pos0, vec3 vel0, float r0, vec3 pos1, vec3 vel1, float r1,
+                  float dt, float &t_out)
+{
+    glm::vec3 v0 = pos1 - pos0;
+    glm::vec3 v1 = v0 + (vel1 - vel0)*dt;
+    float r = (r0 + r1);
+
+    float dot00 = glm::dot(v0, v0);
+    float dot01 = glm::dot(v0, v1);
+    float dot11 = glm::dot(v1, v1);
+
+    float a = dot00 - 2.f * dot01 + dot11;
+    float b = 2.f * (dot01 - dot00);
+    float c = dot00 - r*r;
+
+    float det = b*b - 4.f * a*c;
+
+    if (det > 0.f) {
+        float t = -(b + sqrtf(det)) / (2.f * a);
+        if (0.f <= t && t <= 1.f) {
+            t_out = t;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ObstacleAvoid::accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                               const NeighborOffsets &o, int i) const
+{
+    if (!(n.flags[i] & SteeringNeighbors::CLOSEST))
+        return;
+
+    float t = 0.0f;
+    if (!sweep(ctx.pos, ctx.vel, ctx.radius, n.pos(i), n.vel(i), n.radius[i], horizon, t))
+        return;
+
+    vec3 p0 = ctx.pos + ctx.vel*t*horizon;
+    vec3 p1 = n.pos(i) + n.vel(i)*t*horizon;
+    s.sum += glm::normalize(p0 - p1) * (1.0f - t);
+    s.hit = true;
+
+    if (ctx.debug) {
+        ctx.debug->line(ctx.pos, vec4(0, 1, 0, 0.9f), n.pos(i), vec4(0, 1, 0, 0.1f));
+        ctx.debug->line(ctx.pos, vec4(0, 0, 1, 1), p0, vec4(0, 0, 1, 1));
+        ctx.debug->line(n.pos(i), vec4(1, 0, 0, 1), p1, vec4(1, 0, 0, 1));
+    }
+}
+
+vec3 ObstacleAvoid::finalize(const State &s, const SteeringContext &ctx) const {
+    if (!s.hit)
+        return vec3(0, 0, 0);
+
+    vec3 v = ctx.steer(s.sum);
+    if (ctx.debug)
+        ctx.debug->line(ctx.pos, vec4(1, 1, 1, 0.8f), ctx.pos + v*3.0f, vec4(1, 1, 1, 0.8f));
+    return v;
+}
@@ -0,0 +1,420 @@
+#ifndef STEERING_H
+#define STEERING_H
+
+#include <cmath>
+#include "util/mymath.h"
+#include "game/flowfield.h"
+
+// Steering behaviors for ships, composed at compile time.
+//
+// A behavior is a struct with a weight, the parameters it needs, and:
+//
+//   enum { USES_NEIGHBORS = 0 or 1 };
+//   struct State;                                   // per ship accumulator
+//   void begin(State &s) const;
+//   void accumulate(State &s, const SteeringContext &ctx,
+//                   const SteeringNeighbors &n, const NeighborOffsets &o,
+//                   int i) const;                   // once per neighbor
+//   vec3 finalize(const State &s, const SteeringContext &ctx) const;
+//
+// SteeringPipeline<A, B, ...> runs the accumulate steps of all its
+// behaviors in a single loop over the neighbors, which the compiler fuses
+// into one loop body, and then adds up finalize() * weight in the order
+// the behaviors are listed. Behaviors that aren't listed cost nothing.
+
+
+vec3 limit(vec3 v, float len);
+
+// Neighbors of one ship, gathered once per update into arrays so that the
+// terms all behaviors share can be computed for several neighbors at a
+// time. A neighbor can be both one of the closest ships and a friend.
+struct SteeringNeighbors {
+    enum { CAPACITY = 16 }; // a multiple of the widest SIMD kernel
+
+    enum {
+        CLOSEST = 1,
+        FRIEND = 2
+    };
+
+    float px[CAPACITY], py[CAPACITY], pz[CAPACITY];
+    float vx[CAPACITY], vy[CAPACITY], vz[CAPACITY];
+    float radius[CAPACITY];
+    unsigned char flags[CAPACITY];
+    int count;
+
+    SteeringNeighbors();
+
+    // slots past count keep their old values, which are still valid floats
+    void clear() { count = 0; }
+
+    void add(vec3 pos, vec3 vel, float r, unsigned char f) {
+        px[count] = pos.x;
+        py[count] = pos.y;
+        pz[count] = pos.z;
+        vx[count] = vel.x;
+        vy[count] = vel.y;
+        vz[count] = vel.z;
+        radius[count] = r;
+        flags[count] = f;
+        ++count;
+    }
+
+    // move the neighbors along their velocities, for use dt later
+    void advance(float dt) {
+        for (int i = 0; i < count; ++i) {
+            px[i] += vx[i] * dt;
+            py[i] += vy[i] * dt;
+            pz[i] += vz[i] * dt;
+        }
+    }
+
+    vec3 pos(int i) const { return vec3(px[i], py[i], pz[i]); }
+    vec3 vel(int i) const { return vec3(vx[i], vy[i], vz[i]); }
+};
+
+// Offsets from the neighbors to the ship, their lengths, and the offsets
+// normalized and divided by their lengths. Computed with SSE or AVX where
+// available, doing exactly what glm::length, glm::normalize and operator/=
+// do, so results don't depend on the path taken.
+struct NeighborOffsets {
+    enum { CAPACITY = SteeringNeighbors::CAPACITY };
+    float dx[CAPACITY], dy[CAPACITY], dz[CAPACITY];
+    float len[CAPACITY];
+    float sx[CAPACITY], sy[CAPACITY], sz[CAPACITY];
+};
+
+void calc_offsets(vec3 pos, const SteeringNeighbors &n, NeighborOffsets &o);
+
+// receives debug lines from behaviors that draw them
+class SteeringDebug {
+public:
+    virtual ~SteeringDebug() {}
+    virtual void line(vec3 p0, vec4 color0, vec3 p1, vec4 color1) = 0;
+};
+
+// the ship being steered
+struct SteeringContext {
+    vec3 pos;
+    vec3 vel;
+    float maxspeed;
+    float maxforce;
+    float radius;
+    vec3 target;           // where Arrive and FlowArrive head
+    const FlowField *flow; // towards target, may be null
+    SteeringDebug *debug;  // may be null
+
+    vec3 steer(vec3 dir) const {
+        float len = glm::length(dir);
+        if (len < 0.000001f)
+            return vec3(0, 0, 0);
+        dir *= maxspeed / len;
+        return limit(dir - vel, maxforce);
+    }
+
+    vec3 seek(vec3 t) const {
+        return steer(t - pos);
+    }
+
+    vec3 arrive(vec3 t) const {
+        float brakelimit = 50.0f;
+        vec3 desired = t - pos;
+        float len = glm::length(desired);
+        if (len < 0.000001f)
+            return vec3(0, 0, 0);
+        desired /= len;
+        if (len < brakelimit) {
+            desired *= (len / brakelimit) * maxspeed;
+        } else {
+            desired *= maxspeed;
+        }
+        return limit(desired, maxforce);
+    }
+};
+
+
+// move away from the closest neighbors within distance
+struct Separation {
+    enum { USES_NEIGHBORS = 1 };
+    struct State { vec3 sum; int count; };
+
+    float weight, distance;
+
+    Separation(float weight, float distance) : weight(weight), distance(distance) {}
+
+    void begin(State &s) const { s.sum = vec3(0, 0, 0); s.count = 0; }
+
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {
+        if (!(n.flags[i] & SteeringNeighbors::CLOSEST))
+            return;
+        float len = o.len[i];
+        if (len > distance || len <= 0.00001f)
+            return;
+        s.sum += vec3(o.sx[i], o.sy[i], o.sz[i]);
+        ++s.count;
+    }
+
+    vec3 finalize(const State &s, const SteeringContext &ctx) const {
+        if (s.count == 0)
+            return vec3(0, 0, 0);
+        vec3 sum = s.sum;
+        sum /= (float)s.count;
+        return ctx.steer(sum);
+    }
+};
+
+// move vertically away from the closest neighbors within distance; ships
+// at the same height split up depending on whether they head the same way
+struct ZSeparation {
+    enum { USES_NEIGHBORS = 1 };
+    struct State { float sum; int count; };
+
+    float weight, distance;
+
+    ZSeparation(float weight, float distance) : weight(weight), distance(distance) {}
+
+    void begin(State &s) const { s.sum = 0; s.count = 0; }
+
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {
+        if (!(n.flags[i] & SteeringNeighbors::CLOSEST))
+            return;
+        float len = o.len[i];
+        if (len > distance || len <= 0.00001f)
+            return;
+        float dz = o.dz[i];
+        if (dz == 0.0f)
+            dz = glm::dot(glm::normalize(ctx.vel), glm::normalize(n.vel(i)));
+        dz /= fabsf(dz);
+        dz /= len;
+        s.sum += dz;
+        ++s.count;
+    }
+
+    vec3 finalize(const State &s, const SteeringContext &ctx) const {
+        if (s.count == 0)
+            return vec3(0, 0, 0);
+        vec3 sum(0, 0, s.sum);
+        sum /= (float)s.count;
+        return ctx.steer(sum);
+    }
+};
+
+// match the velocity of friends within distance
+struct Alignment {
+    enum { USES_NEIGHBORS = 1 };
+    struct State { vec3 sum; int count; };
+
+    float weight, distance;
+
+    Alignment(float weight, float distance) : weight(weight), distance(distance) {}
+
+    void begin(State &s) const { s.sum = vec3(0, 0, 0); s.count = 0; }
+
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {
+        if (!(n.flags[i] & SteeringNeighbors::FRIEND) || o.len[i] > distance)
+            return;
+        s.sum += n.vel(i);
+        ++s.count;
+    }
+
+    vec3 finalize(const State &s, const SteeringContext &ctx) const {
+        if (s.count == 0)
+            return vec3(0, 0, 0);
+        vec3 sum = s.sum;
+        sum /= (float)s.count;
+        return ctx.steer(sum);
+    }
+};
+
+// head for the center of friends within distance
+struct Cohesion {
+    enum { USES_NEIGHBORS = 1 };
+    struct State { vec3 sum; int count; };
+
+    float weight, distance;
+
+    Cohesion(float weight, float distance) : weight(weight), distance(distance) {}
+
+    void begin(State &s) const { s.sum = vec3(0, 0, 0); s.count = 0; }
+
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {
+        if (!(n.flags[i] & SteeringNeighbors::FRIEND) || o.len[i] > distance)
+            return;
+        s.sum += n.pos(i);
+        ++s.count;
+    }
+
+    vec3 finalize(const State &s, const SteeringContext &ctx) const {
+        if (s.count == 0)
+            return vec3(0, 0, 0);
+        vec3 sum = s.sum;
+        sum /= (float)s.count;
+        return ctx.seek(sum);
+    }
+};
+
+// steer away from the closest neighbors we would hit within the horizon
+struct ObstacleAvoid {
+    enum { USES_NEIGHBORS = 1 };
+    struct State { vec3 sum; bool hit; };
+
+    float weight, horizon;
+
+    ObstacleAvoid(float weight, float horizon) : weight(weight), horizon(horizon) {}
+
+    void begin(State &s) const { s.sum = vec3(0, 0, 0); s.hit = false; }
+
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const;
+
+    vec3 finalize(const State &s, const SteeringContext &ctx) const;
+};
+
+// return to the XY plane
+struct PlaneHug {
+    enum { USES_NEIGHBORS = 0 };
+    struct State {};
+
+    float weight;
+
+    explicit PlaneHug(float weight) : weight(weight) {}
+
+    void begin(State &s) const {}
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {}
+
+    vec3 finalize(const State &s, const SteeringContext &ctx) const {
+        vec3 target = ctx.pos;
+        target.z = 0;
+        return ctx.arrive(target);
+    }
+};
+
+// head for SteeringContext::target, slowing down on approach
+struct Arrive {
+    enum { USES_NEIGHBORS = 0 };
+    struct State {};
+
+    float weight;
+
+    explicit Arrive(float weight) : weight(weight) {}
+
+    void begin(State &s) const {}
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {}
+
+    vec3 finalize(const State &s, const SteeringContext &ctx) const {
+        return ctx.arrive(ctx.target);
+    }
+};
+
+// head for SteeringContext::target along the shortest path in
+// SteeringContext::flow, slowing down as the path gets short; like Arrive
+// where there is no path
+struct FlowArrive {
+    enum { USES_NEIGHBORS = 0 };
+    struct State {};
+
+    float weight;
+
+    explicit FlowArrive(float weight) : weight(weight) {}
+
+    void begin(State &s) const {}
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {}
+
+    vec3 finalize(const State &s, const SteeringContext &ctx) const {
+        vec3 dir;
+        float distance;
+        if (ctx.flow && ctx.flow->sample(ctx.pos, dir, distance) && distance > 0)
+            return ctx.arrive(ctx.pos + dir * distance);
+        return ctx.arrive(ctx.target);
+    }
+};
+
+
+// The steering of one kind of ship. Ships only know this interface, so
+// each archetype can use a different pipeline.
+class SteeringProgram {
+public:
+    virtual ~SteeringProgram() {}
+    virtual vec3 evaluate(const SteeringContext &ctx, const SteeringNeighbors &n) const = 0;
+};
+
+template <class... Behaviors>
+struct BehaviorChain;
+
+template <>
+struct BehaviorChain<> {
+    enum { USES_NEIGHBORS = 0 };
+    struct State {};
+
+    void begin(State &s) const {}
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {}
+    void finalize(const State &s, const SteeringContext &ctx, vec3 &acc) const {}
+};
+
+template <class Head, class... Tail>
+struct BehaviorChain<Head, Tail...> {
+    typedef BehaviorChain<Tail...> Rest;
+    enum { USES_NEIGHBORS = Head::USES_NEIGHBORS || Rest::USES_NEIGHBORS };
+    struct State {
+        typename Head::State head;
+        typename Rest::State tail;
+    };
+
+    Head head;
+    Rest tail;
+
+    BehaviorChain(const Head &head, const Tail &... tail) : head(head), tail(tail...) {}
+
+    void begin(State &s) const {
+        head.begin(s.head);
+        tail.begin(s.tail);
+    }
+
+    void accumulate(State &s, const SteeringContext &ctx, const SteeringNeighbors &n,
+                    const NeighborOffsets &o, int i) const {
+        head.accumulate(s.head, ctx, n, o, i);
+        tail.accumulate(s.tail, ctx, n, o, i);
+    }
+
+    void finalize(const State &s, const SteeringContext &ctx, vec3 &acc) const {
+        acc += head.finalize(s.head, ctx) * head.weight;
+        tail.finalize(s.tail, ctx, acc);
+    }
+};
+
+template <class... Behaviors>
+class SteeringPipeline : public SteeringProgram {
+public:
+    typedef BehaviorChain<Behaviors...> Chain;
+
+    SteeringPipeline(const Behaviors &... behaviors) : chain(behaviors...) {}
+
+    vec3 evaluate(const SteeringContext &ctx, const SteeringNeighbors &n) const override {
+        typename Chain::State state;
+        chain.begin(state);
+
+        if (Chain::USES_NEIGHBORS && n.count > 0) {
+            NeighborOffsets o;
+            calc_offsets(ctx.pos, n, o);
+            for (int i = 0; i < n.count; ++i)
+                chain.accumulate(state, ctx, n, o, i);
+        }
+
+        vec3 acc(0, 0, 0);
+        chain.finalize(state, ctx, acc);
+        return acc;
+    }
+
+private:
+    Chain chain;
+};
+
+
+#endif
@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <cstring>
 #include <cmath>
+#include <cfloat>
 #include <vector>
 #include <string>
 #include <cstdint>
@@ -19,6 +20,9 @@
 
 #include "util/list.h"
 #include "util/pool.h"
+#include "util/frustum.h"
+#include "util/threadpool.h"
+#include "util/schedule.h"
 
 #include "render/opengl.h"
 #include "render/program.h"
@@ -30,6 +34,12 @@
 
 #include "game/fpscamera.h"
 #include "game/quadtree.h"
+#include "game/octree.h"
+#include "game/spatialgrid.h"
+#include "game/packedquadtree.h"
+#include "game/spatialsnapshot.h"
+#include "game/steering.h"
+#include "game/pathfinder.h"
 #include "game/ecos.h"
 #include "game/skybox.h"
 
@@ -73,6 +83,19 @@ struct LineVertex {
 #pragma pack(pop)
 static std::vector<LineVertex> line_vertexes;
 
+class LineVertexDebug : public SteeringDebug {
+public:
+    explicit LineVertexDebug(std::vector<LineVertex> &lines) : lines(lines) {}
+
+    void line(vec3 p0, vec4 color0, vec3 p1, vec4 color1) override {
+        lines.push_back(LineVertex(p0, color0));
+        lines.push_back(LineVertex(p1, color1));
+    }
+
+private:
+    std::vector<LineVertex> &lines;
+};
+
 static Entity *selected_entity = nullptr;
 
 
@@ -133,8 +156,13 @@ struct PoolComponent : public Component {
 
 
 
+// neighbor distance and maximum neighbor count of the RVO agents of ships
+static const float rvo_neighbor_dist = 50.0f;
+static const int rvo_max_neighbors = 16;
+
 struct Body :
     public PoolComponent<Body, 'BODY', class BodySystem>,
+    public Octree::Object,
     public QuadTree::Object
 {
     vec3 pos;
@@ -143,7 +171,33 @@ struct Body :
     float radius;
     Entity *entity;
 
+    vec3 prev_pos;   // pos before the last update
+    vec3 render_pos; // between prev_pos and pos, see BodySystem::interpolate
+
+    // ships are agents of rvo_sim, anything else a static obstacle; the
+    // other one is RVO::RVO_ERROR
     size_t rvo_agent;
+    size_t rvo_obstacle;
+
+    // agents of the closest ships within rvo_neighbor_dist found by the
+    // last Ship::find_neighbors, which the next BodySystem::update hands
+    // to rvo_sim as the candidate neighbors of rvo_agent, so that it
+    // doesn't search for them again
+    size_t rvo_neighbors[rvo_max_neighbors];
+    int num_rvo_neighbors;
+    bool rvo_neighbors_changed;
+
+    // updates since rvo_neighbors were handed to rvo_sim, or -1 while
+    // rvo_sim searches for the neighbors itself
+    int rvo_neighbors_age;
+
+    PackedQuadTree<Body>::Handle packed_handle;
+
+    void octree_position(float &x, float &y, float &z) override {
+        x = pos.x;
+        y = pos.y;
+        z = pos.z;
+    }
 
     void qtree_position(float &x, float &y) override {
         x = pos.x;
@@ -155,274 +209,363 @@ struct Body :
 
 class BodySystem : public PoolSystem<Body, 'BODY'> {
 public:
-    BodySystem() : quad_tree(-1000, -1000, 1000, 1000, 8) {}
+    // which spatial index the bodies are kept in. Readers only query the
+    // snapshot, which keeps the layout of this index, so this decides how
+    // the snapshot groups the bodies into nodes and how many of them its
+    // queries can skip, not what the queries return.
+    enum IndexType {
+        INDEX_OCTREE,
+        INDEX_QUADTREE,
+        INDEX_PACKED_QUADTREE,
+        INDEX_GRID
+    };
+
+    // tick_rate is the rate update() is called at
+    explicit BodySystem(float tick_rate, IndexType index_type = INDEX_OCTREE) :
+        index_type(index_type),
+        octree(-1000, -1000, -250, 1000, 1000, 250, 8),
+        quad_tree(-1000, -1000, 1000, 1000, 8),
+        packed_quad_tree(-1000, -1000, 1000, 1000, 8),
+        grid(-1000, -1000, 1000, 1000, 50),
+        max_step(0),
+        rvo_neighbors_max_age(1),
+        rvo_schedule(tick_rate, 60.0f)
+    {
+        rvo_sim.setNumVelocityGroups(rvo_schedule.num_buckets());
+        // ships hug the plane, and away from other layers they can avoid
+        // each other in it
+        rvo_sim.setPlanarTolerance(1.0f);
+    }
 
+    const IndexType index_type;
+    Octree octree;
     QuadTree quad_tree;
+    PackedQuadTree<Body> packed_quad_tree;
+    SpatialGrid grid;
     RVO::RVOSimulator rvo_sim;
 
-    void update(float dt);
-};
-
-
-
-
-
+    void update();
+
+    // Place bodies, and the models of ships, alpha of the way from where
+    // they were before the last update() to where they are now, so that
+    // rendering is smooth at any frame rate.
+    void interpolate(float alpha);
+
+    // the furthest any body moved in the last update(), i.e. how far a
+    // render_pos can be from the pos in the snapshot
+    float max_step;
+
+    // Updates after which candidate RVO neighbors that weren't renewed are
+    // dropped, and rvo_sim searches for the neighbors of the agent itself;
+    // set to the period of ShipSystem::neighbor_schedule.
+    int rvo_neighbors_max_age;
+
+    // Rate at which RVO agents compute new velocities. Above the tick rate
+    // the RVO simulation takes several steps per update(), below it the
+    // agents take turns and only some of them compute new velocities each
+    // step. Agents always move every step.
+    UpdateSchedule rvo_schedule;
+
+    // Copy of the bodies and the index as of the end of the last update().
+    // It is never modified while published, so it can be queried from any
+    // number of threads, e.g. while the next update() is running. A
+    // reference must not be kept past the update() after that one.
+    const SpatialSnapshot<Body> &snapshot() const { return snapshots.read(); }
+
+    void index_insert(Body *b);
+    void destroy_component(Body *b);
+
+    template <class Func>
+    void gather_outlines(Func func) {
+        switch (index_type) {
+        case INDEX_OCTREE: octree.gather_outlines(func); break;
+        case INDEX_QUADTREE: quad_tree.gather_outlines(func); break;
+        case INDEX_PACKED_QUADTREE: packed_quad_tree.gather_outlines(func); break;
+        case INDEX_GRID: grid.gather_outlines(func); break;
+        }
+    }
 
+private:
+    void publish_snapshot();
 
+    SnapshotBuffer<Body> snapshots;
 
-static bool sweep(Body *b0, Body *b1, float dt, float &t_out) {
-    glm::vec3 v0 = b1->pos - b0->pos;
-    glm::vec3 v1 = v0 + (b1->vel - b0->vel)*dt;
-    float r = (b0->radius + b1->radius);
+    // the bodies with agents in the order they are passed to and from
+    // rvo_sim in bulk, with their agents and the state passed
+    std::vector<Body *> rvo_bodies;
+    std::vector<size_t> rvo_agents;
+    std::vector<vec3> rvo_pref_vels, rvo_positions, rvo_vels;
+};
 
-    float dot00 = glm::dot(v0, v0);
-    float dot01 = glm::dot(v0, v1);
-    float dot11 = glm::dot(v1, v1);
 
-    float a = dot00 - 2.f * dot01 + dot11;
-    float b = 2.f * (dot01 - dot00);
-    float c = dot00 - r*r;
 
-    float det = b*b - 4.f * a*c;
 
-    if (det > 0.f) {
-        float t = -(b + sqrtf(det)) / (2.f * a);
-        if (0.f <= t && t <= 1.f) {
-            t_out = t;
-            return true;
-        }
-    }
 
-    return false;
-}
 
-vec3 limit(vec3 v, float len) {
-    if (glm::length(v) > len)
-        return glm::normalize(v) * len;
-    return v;
-}
 
 
 struct Ship : public PoolComponent<Ship, 'SHIP', class ShipSystem> {
     vec3 dir;
+    vec3 prev_dir; // dir before the last update
     float maxspeed;
     float maxforce;
     int team;
     Body *body;
+    const SteeringProgram *steering;
 
     enum { MAX_FRIENDS = 4 };
-    Entity *friends[MAX_FRIENDS];
     float friend_radius;
 
     enum { MAX_CLOSEST = 8 };
-    Entity *closest[MAX_CLOSEST];
     float closest_radius;
 
-    Ship() {
-        friend_radius = 50;
-        closest_radius = 50;
-    }
-
-    void init(EntityManager *m, Entity *e) override;
+    // neighbors as of the last search, see ShipSystem::neighbor_schedule
+    SteeringNeighbors neighbors;
 
+    // buckets and last update ticks in the ShipSystem schedules
+    int neighbor_bucket, steering_bucket, lod_bucket;
+    unsigned int neighbor_tick, steering_tick;
 
+    // index in ShipSystem::squads and in its members, or -1 while the
+    // ship is simulated on its own
+    int squad, squad_slot;
 
-    void update(EntityManager *m, float dt);
+    // path to follow while ordered to move, see ShipSystem::order_move;
+    // IDLE otherwise
+    PathRequest path;
+    size_t next_waypoint;
 
-    vec3 planehug() {
-        vec3 target = body->pos;
-        target.z = 0;
-        return arrive(target);
-    }
-
-    vec3 zseparation() {
-        float sep = 20.0f;
-        vec3 sum(0, 0, 0);
-        int count = 0;
-        for (int i = 0; i < MAX_CLOSEST; ++i) {
-            Entity *e = closest[i];
-            if (!e) continue;
-
-            Body *b = e->get_component<Body>();
-            vec3 d = body->pos - b->pos;
-            float len = glm::length(d);
-            if (len > sep || len <= 0.00001f) continue;
-            //d = glm::normalize(d);
-            float dz = d.z;
-            if (dz == 0.0f)
-                dz = glm::dot(glm::normalize(body->vel), glm::normalize(b->vel));
-            dz /= fabsf(dz);
-            dz /= len;
-            sum += vec3(0, 0, dz);
-            ++count;
-        }
-        if (count == 0)
-            return vec3(0, 0, 0);
-        sum /= (float)count;
-        return steer(sum);
-    }
-
-    vec3 separation() {
-        float sep = 20.0f;
-        vec3 sum(0, 0, 0);
-        int count = 0;
-        for (int i = 0; i < MAX_CLOSEST; ++i) {
-            Entity *e = closest[i];
-            if (!e) continue;
-
-            Body *b = e->get_component<Body>();
-            vec3 d = body->pos - b->pos;
-            //d.z = 0;
-            float len = glm::length(d);
-            if (len > sep || len <= 0.00001f) continue;
-            d = glm::normalize(d);
-            d /= len;
-            sum += d;
-            ++count;
-        }
-        if (count == 0)
-            return vec3(0, 0, 0);
-        sum /= (float)count;
-        return steer(sum);
+    Ship() : steering(nullptr), squad(-1), squad_slot(-1), next_waypoint(0) {
+        friend_radius = 50;
+        closest_radius = 50;
     }
 
-    vec3 obstacle_avoid() {
-        float t_horizon = 5.0f;
-        float best_t = 10000000.0f;
-        Body *best_b = nullptr;
-
-        vec3 sum(0, 0, 0);
+    void init(EntityManager *m, Entity *e) override;
 
-        for (int i = 0; i < MAX_CLOSEST; ++i) {
-            Entity *e = closest[i];
-            if (!e) continue;
+    void update(EntityManager *m, const class ShipSystem *sys, SteeringDebug *debug);
+    void find_neighbors(EntityManager *m);
 
-            Body *b = e->get_component<Body>();
+    // turn dir towards the velocity of the body
+    void turn(float dt);
+};
 
-            float t = 0.0f;
-            if (sweep(body, b, t_horizon, t)) {
-                vec3 p0 = body->pos + body->vel*t*t_horizon;
-                vec3 p1 = b->pos + b->vel*t*t_horizon;
-                sum += glm::normalize(p0 - p1) * (1.0f - t);
+// Ships far from the camera and from any enemy, simulated as one agent.
+// Members keep their offsets from the center of the squad and move at the
+// velocity of rvo_agent, a sphere around all of them that avoids obstacles
+// and other agents for the whole squad. They do no neighbor searches,
+// steering or collision avoidance of their own.
+struct Squad {
+    enum { MIN_MEMBERS = 4, MAX_MEMBERS = 32 };
+
+    std::vector<Ship *> members;
+    std::vector<vec3> offsets; // from center, when the squad was formed
+    vec3 center;
+    vec3 vel;     // preferred velocity, steered like a ship's desired_vel
+    float spread; // radius around center that holds all members
+    float maxspeed;
+    float maxforce;
+    int team;
+    int lod_bucket;
+    unsigned int steering_tick;
 
-                line_vertexes.push_back(LineVertex(body->pos, vec4(0, 1, 0, 0.9f)));
-                line_vertexes.push_back(LineVertex(b->pos, vec4(0, 1, 0, 0.1f)));
+    // the agent standing in for the members in rvo_sim, with radius spread;
+    // it is in the RVO group of its members so it doesn't avoid them
+    size_t rvo_agent;
+    size_t rvo_group;
+};
 
-                line_vertexes.push_back(LineVertex(body->pos, vec4(0, 0, 1, 1)));
-                line_vertexes.push_back(LineVertex(p0, vec4(0, 0, 1, 1)));
+class ShipSystem : public PoolSystem<Ship, 'SHIP'> {
+public:
+    // tick_rate is the rate update() is called at
+    ShipSystem(ThreadPool *thread_pool, float tick_rate) :
+        neighbor_schedule(tick_rate, 10.0f),
+        steering_schedule(tick_rate, 30.0f),
+        lod_schedule(tick_rate, 2.0f),
+        lod_center(0, 0, 0),
+        lod_distance(300),
+        combat_distance(100),
+        squad_radius(40),
+        flow_schedule(tick_rate, 2.0f),
+        flow_fields(-600, -600, 600, 600, 10, 8),
+        flow_clearance(10),
+        flow(nullptr),
+        path_finder(-600, -600, 600, 600, 10, 12, 256),
+        path_budget(0.002f),
+        waypoint_radius(10),
+        thread_pool(thread_pool),
+        next_rvo_group(RVO::RVO_NO_GROUP + 1) {}
+
+    // Rates of neighbor searches and of steering. Between searches ships
+    // steer by their last neighbors, moved along their velocities. Rates
+    // above the tick rate are treated as the tick rate.
+    UpdateSchedule neighbor_schedule;
+    UpdateSchedule steering_schedule;
+
+    // Simulation level of detail. Ships of a team within squad_radius of
+    // each other are grouped into squads when the squad would be further
+    // than lod_distance from lod_center and combat_distance from any
+    // enemy, and split up again when it gets closer than that. Ships and
+    // squads are checked in turns at the rate of lod_schedule.
+    UpdateSchedule lod_schedule;
+    vec3 lod_center;
+    float lod_distance;
+    float combat_distance;
+    float squad_radius;
+
+    // Paths around bodies that aren't ships, towards the cursor. The
+    // obstacles are refreshed at the rate of flow_schedule and kept
+    // flow_clearance away from; fields for recent goals are cached.
+    UpdateSchedule flow_schedule;
+    FlowFieldCache flow_fields;
+    float flow_clearance;
+    const FlowField *flow; // for this tick
+
+    // Paths for ships ordered to move, around the same obstacles. At the
+    // start of each tick, the paths found in the background since the last
+    // one are handed to their ships and about path_budget seconds of
+    // searches are issued, see PathFinder::service; nothing waits for
+    // them. Until its path is found a ship heads straight for its goal. Paths are asked for again when the obstacles change along
+    // the rest of them. The next waypoint is taken once within
+    // waypoint_radius of the current one, and ships are done with their
+    // path once within waypoint_radius of the goal.
+    PathFinder path_finder;
+    float path_budget;
+    float waypoint_radius;
+
+    void update(EntityManager *m);
+    void destroy_component(Ship *s);
+
+    // move to goal instead of following the flow field, leaving its squad
+    void order_move(EntityManager *m, Ship *s, vec3 goal);
+
+    // append the debug lines drawn by the last update(); they are kept
+    // until the next one, which may be several frames later
+    void gather_debug_lines(std::vector<LineVertex> &out) const;
+
+private:
+    enum { CHUNK_SIZE = 256 };
+
+    void update_flow(EntityManager *m);
+    void update_lod(EntityManager *m);
+    void update_squads(EntityManager *m);
+    bool needs_detail(const SpatialSnapshot<Body> &snapshot, const Squad &sq, float margin) const;
+    void form_squad(EntityManager *m, Ship *seed);
+    void split_squad(EntityManager *m, int i);
+
+    ThreadPool *thread_pool;
+    std::vector<Ship *> ships;
+    std::vector<std::vector<LineVertex> > chunk_lines;
+    std::vector<Squad> squads;
+    size_t next_rvo_group;
+};
 
-                line_vertexes.push_back(LineVertex(b->pos, vec4(1, 0, 0, 1)));
-                line_vertexes.push_back(LineVertex(p1, vec4(1, 0, 0, 1)));
+void Ship::init(EntityManager *m, Entity *e) {
+    body = e->get_component<Body>();
+    assert(body);
+    assert(steering);
+    prev_dir = dir;
+
+    ShipSystem *sys = m->get_system<ShipSystem>();
+    neighbor_bucket = sys->neighbor_schedule.assign_bucket();
+    steering_bucket = sys->steering_schedule.assign_bucket();
+    lod_bucket = sys->lod_schedule.assign_bucket();
+    neighbor_tick = sys->neighbor_schedule.initial_tick();
+    steering_tick = sys->steering_schedule.initial_tick();
+}
 
-                if (t < best_t) {
-                    best_t = t;
-                    best_b = b;
-                }
-            }
-        }
+// Ship::update only writes its own Ship and the desired_vel and
+// rvo_neighbors of its Body, and sees the other bodies only through the
+// snapshot published by the last BodySystem::update, so ships can be
+// updated in any order on any thread with the same results. Debug lines
+// are collected per chunk and gathered in chunk order, which doesn't
+// depend on the number of threads either. Squads are updated before that,
+// on this thread.
+void ShipSystem::update(EntityManager *m) {
+    update_flow(m);
+    update_lod(m);
+    update_squads(m);
+    path_finder.service(path_budget);
+
+    ships.clear();
+    for (Ship *ship : *this) {
+        if (ship->squad < 0)
+            ships.push_back(ship);
+    }
 
-        if (!best_b)
-            return vec3(0, 0, 0);
+    int num_chunks = ((int)ships.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if ((int)chunk_lines.size() < num_chunks)
+        chunk_lines.resize(num_chunks);
 
-        //vec3 v = steer(glm::cross(body->vel, body->pos - best_b->pos));
-        vec3 v = steer(sum);
+    thread_pool->parallel_for((int)ships.size(), CHUNK_SIZE, [&](int chunk, int begin, int end) {
+        std::vector<LineVertex> &lines = chunk_lines[chunk];
+        lines.clear();
+        LineVertexDebug debug(lines);
+        for (int i = begin; i < end; ++i)
+            ships[i]->update(m, this, &debug);
+    });
 
-        line_vertexes.push_back(LineVertex(body->pos, vec4(1, 1, 1, 0.8f)));
-        line_vertexes.push_back(LineVertex(body->pos + v*3.0f, vec4(1, 1, 1, 0.8f)));
+    neighbor_schedule.advance();
+    steering_schedule.advance();
+    lod_schedule.advance();
+    flow_schedule.advance();
 
-        return v;
-    }
+    for (size_t c = num_chunks; c < chunk_lines.size(); ++c)
+        chunk_lines[c].clear();
+}
 
-    vec3 alignment() {
-        float neighbordist = 50;
-        vec3 sum(0, 0, 0);
-        int count = 0;
-        for (int i = 0; i < MAX_FRIENDS; ++i) {
-            Entity *e = friends[i];
-            if (!e) continue;
+void ShipSystem::gather_debug_lines(std::vector<LineVertex> &out) const {
+    for (const std::vector<LineVertex> &lines : chunk_lines)
+        out.insert(out.end(), lines.begin(), lines.end());
+}
 
-            Body *b = e->get_component<Body>();
-            Ship *s = b->entity->get_component<Ship>();
-            if (s->team != team) continue;
-            
-            vec3 d = body->pos - b->pos;
-            float dist = glm::length(d);
-            if (dist > neighbordist) continue;
-            sum += b->vel;
-            ++count;
+void ShipSystem::update_flow(EntityManager *m) {
+    if (flow_schedule.due(0)) {
+        flow_fields.begin_obstacles();
+        path_finder.begin_obstacles();
+        for (Body *b : *m->get_system<BodySystem>()) {
+            if (!b->entity->get_component<Ship>()) {
+                flow_fields.add_obstacle(b->pos, b->radius + flow_clearance);
+                path_finder.add_obstacle(b->pos, b->radius + flow_clearance);
+            }
         }
-        if (count == 0)
-            return vec3(0, 0, 0);
-        sum /= (float)count;
-        return steer(sum);
-    }
-
-    vec3 cohesion() {
-        float neighbordist = 50;
-        vec3 sum(0, 0, 0);
-        int count = 0;
-        for (int i = 0; i < MAX_FRIENDS; ++i) {
-            Entity *e = friends[i];
-            if (!e) continue;
-
-            Body *b = e->get_component<Body>();
-            Ship *s = b->entity->get_component<Ship>();
-            if (s->team != team) continue;
-            
-            vec3 d = body->pos - b->pos;
-            float len = glm::length(d);
-            if (len > neighbordist) continue;
-            sum += b->pos;
-            ++count;
+        flow_fields.end_obstacles();
+        if (path_finder.end_obstacles()) {
+            // the rest of a path may run through the new obstacles, or
+            // around ones that are gone; a path that wasn't found may be
+            // there now wherever the changes are
+            for (Ship *s : *this) {
+                bool again = s->path.state == PathRequest::FAILED ||
+                    (s->path.state == PathRequest::DONE &&
+                     path_finder.crosses_changes(s->body->pos, s->path.waypoints, s->next_waypoint));
+                if (again) {
+                    path_finder.request(&s->path, s->body->pos, s->path.goal);
+                    s->next_waypoint = 0;
+                }
+            }
         }
-        if (count == 0)
-            return vec3(0, 0, 0);
-        sum /= (float)count;
-        return seek(sum);
-    }
-
-    vec3 seek(vec3 target) {
-        return steer(target - body->pos);
-    }
-
-    vec3 steer(vec3 dir) {
-        float len = glm::length(dir);
-        if (len < 0.000001f)
-            return vec3(0, 0, 0);
-        dir *= maxspeed / len;
-        return limit(dir - body->vel, maxforce);
     }
+    flow = flow_fields.field(cursor_pos);
+}
 
-    vec3 arrive(vec3 target) {
-        float brakelimit = 50.0f;
-        vec3 desired = target - body->pos;
-        float len = glm::length(desired);
-        if (len < 0.000001f)
-            return vec3(0, 0, 0);
-        desired /= len;
-        if (len < brakelimit) {
-            desired *= (len / brakelimit) * maxspeed;
-        } else {
-            desired *= maxspeed;
-        }
-        return limit(desired, maxforce);
+void ShipSystem::destroy_component(Ship *s) {
+    if (s->squad >= 0) {
+        Squad &sq = squads[s->squad];
+        int last = (int)sq.members.size() - 1;
+        sq.members[s->squad_slot] = sq.members[last];
+        sq.offsets[s->squad_slot] = sq.offsets[last];
+        sq.members[s->squad_slot]->squad_slot = s->squad_slot;
+        sq.members.pop_back();
+        sq.offsets.pop_back();
     }
-};
-
-class ShipSystem : public PoolSystem<Ship, 'SHIP'> {
-public:
-    void update(EntityManager *m, float dt);
-};
-
-void Ship::init(EntityManager *m, Entity *e) {
-    body = e->get_component<Body>();
-    assert(body);
+    path_finder.cancel(&s->path);
+    PoolSystem<Ship, 'SHIP'>::destroy_component(s);
 }
 
-void ShipSystem::update(EntityManager *m, float dt) {
-    for (Ship *ship : *this) {
-        ship->update(m, dt);
-    }
+void ShipSystem::order_move(EntityManager *m, Ship *s, vec3 goal) {
+    if (s->squad >= 0)
+        split_squad(m, s->squad);
+    path_finder.request(&s->path, s->body->pos, goal);
+    s->next_waypoint = 0;
 }
 
 
@@ -439,28 +582,98 @@ public:
 
     Program::Ref program;
     Mesh::Ref mesh;
+
+    // bounding sphere radius, from the mesh radius and the scale of
+    // model_matrix at init; must be updated if the scale changes later
+    float radius;
+
+    void init(EntityManager *m, Entity *e) override;
+
+private:
+    friend class SimpleRenderableSystem;
+    ListLink unindexed_link;
 };
 
 class SimpleRenderableSystem : public PoolSystem<SimpleRenderable, 'SRND'> {
 public:
-    void render(RenderQueue *renderqueue, mat4 view_matrix, mat4 projection_matrix) {
-        for (SimpleRenderable *r : *this) {
-            mat4 vm = view_matrix * r->model_matrix;
-            mat4 pvm = projection_matrix * vm;
-            mat3 normal = glm::inverseTranspose(mat3(vm));
-
-            auto cmd = renderqueue->add_command(r->program, r->mesh);
-            cmd->add_uniform("m_pvm", pvm);
-            cmd->add_uniform("m_vm", vm);
-            cmd->add_uniform("m_normal", normal);
-            cmd->add_uniform("mat_ambient", r->ambient_color);
-            cmd->add_uniform("mat_diffuse", r->diffuse_color);
-            cmd->add_uniform("mat_specular", r->specular_color);
-            cmd->add_uniform("mat_shininess", r->shininess);
+    struct Stats {
+        int visible;
+        int culled;
+    };
+
+    SimpleRenderableSystem() : max_indexed_radius(0) {
+        stats.visible = 0;
+        stats.culled = 0;
+    }
+
+    // counts from the last render()
+    Stats stats;
+
+    // Renderables that belong to a body are found through the body
+    // snapshot, with the frustum widened by the largest renderable radius
+    // since bodies can be smaller than what is drawn for them, and by
+    // max_body_step since they are drawn at interpolated positions. Every
+    // candidate is then tested with its own bounding sphere.
+    void render(RenderQueue *renderqueue, mat4 view_matrix, mat4 projection_matrix,
+                const SpatialSnapshot<Body> &bodies, float max_body_step)
+    {
+        Frustum frustum(projection_matrix * view_matrix);
+        stats.visible = 0;
+
+        bodies.query_frustum(frustum.expanded(max_indexed_radius + max_body_step),
+                             [&](const SpatialSnapshot<Body>::Entry &e) mutable
+        {
+            SimpleRenderable *r = e.obj->entity->get_component<SimpleRenderable>();
+            if (r && frustum.intersects_sphere(vec3(r->model_matrix[3]), r->radius))
+                render(renderqueue, view_matrix, projection_matrix, r);
+        });
+
+        for (SimpleRenderable *r : unindexed) {
+            if (frustum.intersects_sphere(vec3(r->model_matrix[3]), r->radius))
+                render(renderqueue, view_matrix, projection_matrix, r);
         }
+
+        stats.culled = pool.size() - stats.visible;
     }
+
+private:
+    friend class SimpleRenderable;
+
+    void render(RenderQueue *renderqueue, const mat4 &view_matrix, const mat4 &projection_matrix,
+                SimpleRenderable *r)
+    {
+        mat4 vm = view_matrix * r->model_matrix;
+        mat4 pvm = projection_matrix * vm;
+        mat3 normal = glm::inverseTranspose(mat3(vm));
+
+        auto cmd = renderqueue->add_command(r->program, r->mesh);
+        cmd->add_uniform("m_pvm", pvm);
+        cmd->add_uniform("m_vm", vm);
+        cmd->add_uniform("m_normal", normal);
+        cmd->add_uniform("mat_ambient", r->ambient_color);
+        cmd->add_uniform("mat_diffuse", r->diffuse_color);
+        cmd->add_uniform("mat_specular", r->specular_color);
+        cmd->add_uniform("mat_shininess", r->shininess);
+        ++stats.visible;
+    }
+
+    float max_indexed_radius;
+    List<SimpleRenderable, &SimpleRenderable::unindexed_link> unindexed; // no body
 };
 
+void SimpleRenderable::init(EntityManager *m, Entity *e) {
+    float scale_squared = std::max(glm::dot(model_matrix[0], model_matrix[0]),
+                          std::max(glm::dot(model_matrix[1], model_matrix[1]),
+                                   glm::dot(model_matrix[2], model_matrix[2])));
+    radius = mesh->radius() * sqrtf(scale_squared);
+
+    SimpleRenderableSystem *sys = m->get_system<SimpleRenderableSystem>();
+    if (e->get_component<Body>())
+        sys->max_indexed_radius = std::max(sys->max_indexed_radius, radius);
+    else
+        sys->unindexed.push_back(this);
+}
+
 /*
 class Doodad : public PoolComponent<Doodad, 'DOOD', class DoodadSystem> {
 public:
@@ -478,10 +691,6 @@ static RVO::Vector3 to_rvo(vec3 v) {
     return RVO::Vector3(v.x, v.y, v.z);
 }
 
-static vec3 from_rvo(RVO::Vector3 v) {
-    return vec3(v.x(), v.y(), v.z());
-}
-
 static mat4 calc_rotation_matrix(vec3 dir) {
     vec3 up(0, 0, 1);
     vec3 forward(glm::normalize(dir));
@@ -499,106 +708,300 @@ static mat4 calc_rotation_matrix(vec3 dir) {
 
 void Body::init(EntityManager *m, Entity *e) {
     BodySystem *sys = m->get_system<BodySystem>();
-    sys->quad_tree.insert(this);
+    sys->index_insert(this);
     entity = e;
+    prev_pos = pos;
+    render_pos = pos;
 
-    float max_vel = 0;
+    num_rvo_neighbors = 0;
+    rvo_neighbors_changed = false;
+    rvo_neighbors_age = -1;
+
+    RVO::Vector3 rvo_pos = to_rvo(pos);
     Ship *s = entity->get_component<Ship>();
     if (s) {
-        max_vel = s->maxspeed;
+        rvo_agent = sys->rvo_sim.addAgent(rvo_pos, rvo_neighbor_dist, rvo_max_neighbors, 10.0f, radius, s->maxspeed);
+        rvo_obstacle = RVO::RVO_ERROR;
+    } else {
+        rvo_agent = RVO::RVO_ERROR;
+        rvo_obstacle = sys->rvo_sim.addObstacle(rvo_pos, radius);
     }
-    RVO::Vector3 rvo_pos = to_rvo(pos);
-    rvo_agent = sys->rvo_sim.addAgent(rvo_pos, 50.0f, 16, 10.0f, radius, max_vel);
 }
 
-void BodySystem::update(float dt) {
-    rvo_sim.setTimeStep(dt);
-    rvo_sim.doStep();
-    
+void BodySystem::index_insert(Body *b) {
+    switch (index_type) {
+    case INDEX_OCTREE: octree.insert(b); break;
+    case INDEX_QUADTREE: quad_tree.insert(b); break;
+    case INDEX_PACKED_QUADTREE: b->packed_handle = packed_quad_tree.insert(b, b->pos.x, b->pos.y); break;
+    case INDEX_GRID: grid.insert(b); break;
+    }
+}
+
+void BodySystem::destroy_component(Body *b) {
+    // the trees unlink their objects on destruction, the others do not
+    if (index_type == INDEX_PACKED_QUADTREE)
+        packed_quad_tree.remove(b->packed_handle);
+    else if (index_type == INDEX_GRID)
+        grid.remove(b);
+    if (b->rvo_agent != RVO::RVO_ERROR)
+        rvo_sim.removeAgent(b->rvo_agent);
+    else
+        rvo_sim.removeObstacle(b->rvo_obstacle);
+    PoolSystem<Body, 'BODY'>::destroy_component(b);
+}
+
+// glm vectors are passed to rvo_sim as packed xyz floats
+static_assert(sizeof(vec3) == 3 * sizeof(float), "vec3 must be three packed floats");
+
+void BodySystem::update() {
+    // the velocities desired in this tick apply to this tick's steps
+    rvo_bodies.clear();
+    rvo_agents.clear();
+    rvo_pref_vels.clear();
     for (Body *b : *this) {
-        rvo_sim.setAgentPrefVelocity(b->rvo_agent, to_rvo(b->desired_vel));
-        b->pos = from_rvo(rvo_sim.getAgentPosition(b->rvo_agent));
-        b->vel = from_rvo(rvo_sim.getAgentVelocity(b->rvo_agent));
-        b->qtree_update();
-        
+        if (b->rvo_agent == RVO::RVO_ERROR)
+            continue; // static obstacle
+        rvo_bodies.push_back(b);
+        rvo_agents.push_back(b->rvo_agent);
+        rvo_pref_vels.push_back(b->desired_vel);
+        if (b->rvo_neighbors_changed) {
+            rvo_sim.setAgentNeighbors(b->rvo_agent, b->rvo_neighbors, b->num_rvo_neighbors);
+            b->rvo_neighbors_changed = false;
+            b->rvo_neighbors_age = 0;
+        } else if (b->rvo_neighbors_age >= 0 && ++b->rvo_neighbors_age >= rvo_neighbors_max_age) {
+            // the ship missed its search, so the candidates may be stale
+            rvo_sim.clearAgentNeighbors(b->rvo_agent);
+            b->rvo_neighbors_age = -1;
+        }
+    }
+    size_t n = rvo_bodies.size();
+    if (n > 0)
+        rvo_sim.setAgentPrefVelocities(&rvo_agents[0], n, &rvo_pref_vels[0].x);
+
+    rvo_sim.setTimeStep(rvo_schedule.substep_dt());
+    for (int i = 0; i < rvo_schedule.substeps(); ++i)
+        rvo_sim.doStep();
+    rvo_schedule.advance();
+
+    rvo_positions.resize(n);
+    rvo_vels.resize(n);
+    if (n > 0) {
+        rvo_sim.getAgentPositions(&rvo_agents[0], n, &rvo_positions[0].x);
+        rvo_sim.getAgentVelocities(&rvo_agents[0], n, &rvo_vels[0].x);
+    }
+
+    // re-bin moved bodies as we go, but split and merge tree nodes only
+    // once all of them have been moved
+    if (index_type == INDEX_OCTREE)
+        octree.begin_batch();
+    else if (index_type == INDEX_QUADTREE)
+        quad_tree.begin_batch();
+
+    float max_step_squared = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Body *b = rvo_bodies[i];
+        b->prev_pos = b->pos;
+        b->pos = rvo_positions[i];
+        b->vel = rvo_vels[i];
+        vec3 step = b->pos - b->prev_pos;
+        max_step_squared = std::max(max_step_squared, glm::dot(step, step));
+        if (index_type == INDEX_OCTREE)
+            b->octree_update();
+        else if (index_type == INDEX_QUADTREE)
+            b->qtree_update();
+        else if (index_type == INDEX_PACKED_QUADTREE)
+            packed_quad_tree.update(b->packed_handle, b->pos.x, b->pos.y);
+    }
+    max_step = sqrtf(max_step_squared);
+
+    if (index_type == INDEX_OCTREE)
+        octree.end_batch();
+    else if (index_type == INDEX_QUADTREE)
+        quad_tree.end_batch();
+    else if (index_type == INDEX_GRID)
+        grid.rebuild();
+
+    publish_snapshot();
+}
+
+void BodySystem::interpolate(float alpha) {
+    for (Body *b : *this) {
+        b->render_pos = glm::mix(b->prev_pos, b->pos, alpha);
+
         Ship *s = b->entity->get_component<Ship>();
         SimpleRenderable *r = b->entity->get_component<SimpleRenderable>();
         if (r && s) {
-            r->model_matrix = glm::translate(b->pos) * calc_rotation_matrix(s->dir);
+            vec3 dir = glm::mix(s->prev_dir, s->dir, alpha);
+            r->model_matrix = glm::translate(b->render_pos) * calc_rotation_matrix(dir);
         }
     }
 }
 
+void BodySystem::publish_snapshot() {
+    SpatialSnapshot<Body> &s = snapshots.write();
+    s.clear();
+
+    // dying bodies are destroyed before the next snapshot is published, so
+    // they must not be in this one
+    auto add = [&](Body *b) {
+        if (!b->entity->dying())
+            s.add(b, b->pos, b->vel, b->radius);
+    };
+    switch (index_type) {
+    case INDEX_OCTREE:
+        octree.flatten(s, [&](Octree::Object *obj) { add(static_cast<Body *>(obj)); });
+        break;
+    case INDEX_QUADTREE:
+        quad_tree.flatten(s, [&](QuadTree::Object *obj) { add(static_cast<Body *>(obj)); });
+        break;
+    case INDEX_PACKED_QUADTREE:
+        packed_quad_tree.flatten(s, add);
+        break;
+    case INDEX_GRID:
+        grid.flatten(s, [&](QuadTree::Object *obj) { add(static_cast<Body *>(obj)); });
+        break;
+    }
+
+    snapshots.publish();
+}
+
 static float adjust_query_radius(float radius, int num_found, int maximum) {
     if (num_found < maximum) radius += 0.1f;
     else if (num_found > maximum) radius -= 0.1f;
     return clamp(radius, 1.0f, 50.0f);
 }
 
-void Ship::update(EntityManager *m, float dt) {
-    BodySystem *sys = m->get_system<BodySystem>();
-    Entity *entity = body->entity;
+void Ship::find_neighbors(EntityManager *m) {
+    const SpatialSnapshot<Body> &snapshot = m->get_system<BodySystem>()->snapshot();
 
     int num_friends = 0;
     int num_closest = 0;
-    memset(friends, 0, sizeof(friends));
-    memset(closest, 0, sizeof(closest));
+
+    neighbors.clear();
+    body->num_rvo_neighbors = 0;
+    float rvo_dists_squared[rvo_max_neighbors];
 
     float friend_radius_squared = friend_radius*friend_radius;
     float closest_radius_squared = closest_radius*closest_radius;
-    float query_radius = std::max(friend_radius, closest_radius);
+    float rvo_radius_squared = rvo_neighbor_dist*rvo_neighbor_dist;
+    float query_radius = std::max(std::max(friend_radius, closest_radius), rvo_neighbor_dist);
     
-    vec2 p(body->pos);
+    vec3 p(body->pos);
 
-    sys->quad_tree.query(p.x - query_radius, p.y - query_radius,
-                         p.x + query_radius, p.y + query_radius,
-                         [&](QuadTree::Object *obj) mutable
+    snapshot.query(p, query_radius, [&](const SpatialSnapshot<Body>::Entry &e) mutable
     {
-        Body *b = static_cast<Body *>(obj);
+        Body *b = e.obj;
         if (b == body)
             return;
-        vec2 d = vec2(b->pos) - p;
-        float dist_squared = d.x*d.x + d.y*d.y;
+        vec3 d = e.pos - p;
+        float dist_squared = glm::dot(d, d);
+
+        unsigned char flags = 0;
 
         if (dist_squared <= friend_radius_squared) {
             Ship *s = b->entity->get_component<Ship>();
             if (s && s->team == team) {
                 if (num_friends < MAX_FRIENDS)
-                    friends[num_friends] = b->entity;
+                    flags |= SteeringNeighbors::FRIEND;
                 num_friends++;
             }
         }
 
         if (dist_squared <= closest_radius_squared) {
             if (num_closest < MAX_CLOSEST)
-                closest[num_closest] = b->entity;
+                flags |= SteeringNeighbors::CLOSEST;
             num_closest++;
         }
+
+        if (flags)
+            neighbors.add(e.pos, e.vel, e.radius, flags);
+
+        // RVO takes the closest agents it can see, whatever steering uses
+        if (b->rvo_agent != RVO::RVO_ERROR && dist_squared <= rvo_radius_squared) {
+            int n = body->num_rvo_neighbors;
+            if (n == rvo_max_neighbors) {
+                if (dist_squared >= rvo_dists_squared[n - 1])
+                    return;
+                --n;
+            }
+            while (n > 0 && dist_squared < rvo_dists_squared[n - 1]) {
+                body->rvo_neighbors[n] = body->rvo_neighbors[n - 1];
+                rvo_dists_squared[n] = rvo_dists_squared[n - 1];
+                --n;
+            }
+            body->rvo_neighbors[n] = b->rvo_agent;
+            rvo_dists_squared[n] = dist_squared;
+            if (body->num_rvo_neighbors < rvo_max_neighbors)
+                body->num_rvo_neighbors++;
+        }
     });
+    body->rvo_neighbors_changed = true;
 
     friend_radius = adjust_query_radius(friend_radius, num_friends, MAX_FRIENDS);
     closest_radius = adjust_query_radius(closest_radius, num_closest, MAX_CLOSEST);
+}
 
+void Ship::update(EntityManager *m, const ShipSystem *sys, SteeringDebug *debug) {
+    prev_dir = dir;
 
+    if (sys->neighbor_schedule.due(neighbor_bucket)) {
+        find_neighbors(m);
+        neighbor_tick = sys->neighbor_schedule.tick();
+    }
 
-    vec3 acc(0, 0, 0);
-
-    //acc = obstacle_avoid();
-
-    //if (acc == vec3(0, 0, 0)) {
-    acc += separation() * 1.5f;
-    acc += alignment() * 1.0f;
-    acc += cohesion() * 1.0f;
+    if (!sys->steering_schedule.due(steering_bucket))
+        return;
+    float dt = sys->steering_schedule.dt_since(steering_tick);
+    steering_tick = sys->steering_schedule.tick();
+
+    SteeringContext ctx;
+    ctx.pos = body->pos;
+    ctx.vel = body->vel;
+    ctx.maxspeed = maxspeed;
+    ctx.maxforce = maxforce;
+    ctx.radius = body->radius;
+    ctx.target = cursor_pos;
+    ctx.flow = sys->flow;
+    ctx.debug = debug;
+
+    // at the goal, go back to the flow field and to joining squads
+    if ((path.state == PathRequest::DONE || path.state == PathRequest::FAILED) &&
+        glm::distance(body->pos, path.goal) < sys->waypoint_radius)
+    {
+        path.state = PathRequest::IDLE;
+    }
 
-    acc += planehug() * 1.5f;
-    //acc += zseparation() * 1.5f;
+    if (path.state != PathRequest::IDLE) {
+        ctx.target = path.goal;
+        ctx.flow = nullptr;
+        if (path.state == PathRequest::DONE) {
+            while (next_waypoint + 1 < path.waypoints.size() &&
+                   glm::distance(body->pos, path.waypoints[next_waypoint]) < sys->waypoint_radius)
+            {
+                ++next_waypoint;
+            }
+            ctx.target = path.waypoints[next_waypoint];
+        }
+    }
 
-    acc += arrive(cursor_pos) * 1.5f;
-    //}
+    // the neighbors were found at the start of tick neighbor_tick
+    vec3 acc;
+    float age = sys->neighbor_schedule.dt_since(neighbor_tick);
+    if (age > 0) {
+        SteeringNeighbors moved(neighbors);
+        moved.advance(age);
+        acc = steering->evaluate(ctx, moved);
+    } else {
+        acc = steering->evaluate(ctx, neighbors);
+    }
 
     body->desired_vel += acc * dt;
     body->desired_vel = limit(body->desired_vel, maxspeed);
 
+    turn(dt);
+}
+
+void Ship::turn(float dt) {
     float len = glm::length(body->vel);
     if (len > 0) {
         vec3 v = body->vel / len;
@@ -616,6 +1019,188 @@ void Ship::update(EntityManager *m, float dt) {
 
 
 
+// steering archetypes; each ship pays only for the behaviors listed in
+// its pipeline, e.g. add ObstacleAvoid(1.0f, 5.0f) or ZSeparation(1.5f, 20.0f)
+static const SteeringPipeline<Separation, Alignment, Cohesion, PlaneHug, FlowArrive> boid_steering(
+    Separation(1.5f, 20.0f),
+    Alignment(1.0f, 50.0f),
+    Cohesion(1.0f, 50.0f),
+    PlaneHug(1.5f),
+    FlowArrive(1.5f));
+
+// how squads as a whole steer
+static const SteeringPipeline<PlaneHug, FlowArrive> squad_steering(
+    PlaneHug(1.5f),
+    FlowArrive(1.5f));
+
+// how fast squad members correct drift from their place in the squad
+static const float squad_formation_gain = 1.0f;
+
+// whether a ship of another team is within distance of pos
+static bool enemy_near(const SpatialSnapshot<Body> &snapshot, vec3 pos, float distance, int team) {
+    bool found = false;
+    snapshot.query(pos, distance, [&](const SpatialSnapshot<Body>::Entry &e) mutable
+    {
+        Ship *s = e.obj->entity->get_component<Ship>();
+        if (s && s->team != team)
+            found = true;
+    });
+    return found;
+}
+
+bool ShipSystem::needs_detail(const SpatialSnapshot<Body> &snapshot, const Squad &sq, float margin) const {
+    return glm::distance(sq.center, lod_center) - sq.spread < lod_distance + margin ||
+           enemy_near(snapshot, sq.center, combat_distance + sq.spread + margin, sq.team);
+}
+
+// The squad must be clear of the camera and enemies by squad_radius when
+// formed, so that it isn't split up again right away.
+void ShipSystem::form_squad(EntityManager *m, Ship *seed) {
+    const SpatialSnapshot<Body> &snapshot = m->get_system<BodySystem>()->snapshot();
+
+    Squad sq;
+    snapshot.query(seed->body->pos, squad_radius, [&](const SpatialSnapshot<Body>::Entry &e) mutable
+    {
+        Ship *s = e.obj->entity->get_component<Ship>();
+        if (s && s->squad < 0 && s->path.state == PathRequest::IDLE && s->team == seed->team &&
+            sq.members.size() < Squad::MAX_MEMBERS)
+        {
+            sq.members.push_back(s);
+        }
+    });
+    if (sq.members.size() < Squad::MIN_MEMBERS)
+        return;
+
+    sq.center = vec3(0, 0, 0);
+    sq.vel = vec3(0, 0, 0);
+    sq.maxspeed = FLT_MAX;
+    sq.maxforce = FLT_MAX;
+    for (Ship *s : sq.members) {
+        sq.center += s->body->pos;
+        sq.vel += s->body->vel;
+        sq.maxspeed = std::min(sq.maxspeed, s->maxspeed);
+        sq.maxforce = std::min(sq.maxforce, s->maxforce);
+    }
+    sq.center /= (float)sq.members.size();
+    sq.vel /= (float)sq.members.size();
+    sq.spread = 0;
+    for (Ship *s : sq.members) {
+        sq.offsets.push_back(s->body->pos - sq.center);
+        sq.spread = std::max(sq.spread, glm::length(sq.offsets.back()) + s->body->radius);
+    }
+    sq.team = seed->team;
+
+    if (needs_detail(snapshot, sq, squad_radius))
+        return;
+
+    sq.lod_bucket = lod_schedule.assign_bucket();
+    sq.steering_tick = steering_schedule.initial_tick();
+
+    RVO::RVOSimulator &rvo_sim = m->get_system<BodySystem>()->rvo_sim;
+    sq.rvo_group = next_rvo_group++;
+    sq.rvo_agent = rvo_sim.addAgent(to_rvo(sq.center), rvo_neighbor_dist + sq.spread, rvo_max_neighbors,
+                                    10.0f, sq.spread, sq.maxspeed, to_rvo(sq.vel));
+    rvo_sim.setAgentGroup(sq.rvo_agent, sq.rvo_group);
+    for (size_t i = 0; i < sq.members.size(); ++i) {
+        Ship *s = sq.members[i];
+        s->squad = (int)squads.size();
+        s->squad_slot = (int)i;
+        rvo_sim.setAgentAvoidance(s->body->rvo_agent, false);
+        rvo_sim.setAgentGroup(s->body->rvo_agent, sq.rvo_group);
+    }
+    squads.push_back(sq);
+}
+
+// members go back to being simulated on their own, starting from this tick
+void ShipSystem::split_squad(EntityManager *m, int i) {
+    RVO::RVOSimulator &rvo_sim = m->get_system<BodySystem>()->rvo_sim;
+    rvo_sim.removeAgent(squads[i].rvo_agent);
+    for (Ship *s : squads[i].members) {
+        s->squad = -1;
+        s->squad_slot = -1;
+        rvo_sim.setAgentAvoidance(s->body->rvo_agent, true);
+        rvo_sim.setAgentGroup(s->body->rvo_agent, RVO::RVO_NO_GROUP);
+        s->find_neighbors(m);
+        s->neighbor_tick = neighbor_schedule.tick();
+        s->steering_tick = steering_schedule.initial_tick();
+    }
+
+    if (i != (int)squads.size() - 1) {
+        squads[i] = squads.back();
+        for (Ship *s : squads[i].members)
+            s->squad = i;
+    }
+    squads.pop_back();
+}
+
+void ShipSystem::update_lod(EntityManager *m) {
+    const SpatialSnapshot<Body> &snapshot = m->get_system<BodySystem>()->snapshot();
+
+    // backwards, so squads moved into the place of split ones were visited
+    for (int i = (int)squads.size() - 1; i >= 0; --i) {
+        const Squad &sq = squads[i];
+        if (sq.members.size() < 2 ||
+            (lod_schedule.due(sq.lod_bucket) && needs_detail(snapshot, sq, 0)))
+        {
+            split_squad(m, i);
+        }
+    }
+
+    for (Ship *s : *this) {
+        if (s->squad >= 0 || !lod_schedule.due(s->lod_bucket) || s->body->entity->dying())
+            continue;
+        if (glm::distance(s->body->pos, lod_center) < lod_distance + squad_radius)
+            continue;
+        form_squad(m, s);
+    }
+}
+
+void ShipSystem::update_squads(EntityManager *m) {
+    RVO::RVOSimulator &rvo_sim = m->get_system<BodySystem>()->rvo_sim;
+    const SteeringNeighbors no_neighbors;
+
+    for (Squad &sq : squads) {
+        if (sq.members.empty())
+            continue;
+
+        float dt = steering_schedule.dt_since(sq.steering_tick);
+        sq.steering_tick = steering_schedule.tick();
+
+        sq.center = vec3(0, 0, 0);
+        for (Ship *s : sq.members)
+            sq.center += s->body->pos;
+        sq.center /= (float)sq.members.size();
+
+        // the velocity the proxy took to avoid others in the last steps;
+        // it follows the members rather than the other way around
+        const RVO::Vector3 &v = rvo_sim.getAgentVelocity(sq.rvo_agent);
+        vec3 vel(v.x(), v.y(), v.z());
+        rvo_sim.setAgentPosition(sq.rvo_agent, to_rvo(sq.center));
+
+        SteeringContext ctx;
+        ctx.pos = sq.center;
+        ctx.vel = vel;
+        ctx.maxspeed = sq.maxspeed;
+        ctx.maxforce = sq.maxforce;
+        ctx.radius = sq.spread;
+        ctx.target = cursor_pos;
+        ctx.flow = flow;
+        ctx.debug = nullptr;
+
+        vec3 acc = squad_steering.evaluate(ctx, no_neighbors);
+        sq.vel = limit(sq.vel + acc * dt, sq.maxspeed);
+        rvo_sim.setAgentPrefVelocity(sq.rvo_agent, to_rvo(sq.vel));
+
+        for (size_t i = 0; i < sq.members.size(); ++i) {
+            Ship *s = sq.members[i];
+            vec3 drift = sq.center + sq.offsets[i] - s->body->pos;
+            s->body->desired_vel = limit(vel + drift * squad_formation_gain, s->maxspeed);
+            s->prev_dir = s->dir;
+            s->turn(dt);
+        }
+    }
+}
+
 static void do_spawn_boid(EntityManager *m, vec3 pos) {
     pos.z = glm::linearRand(-10.0f, 10.0f);
     Entity *e = m->create_entity();
@@ -629,6 +1214,7 @@ static void do_spawn_boid(EntityManager *m, vec3 pos) {
     s->maxspeed = glm::linearRand(10.0f, 30.0f);
     s->maxforce = glm::linearRand(0.5f, 2.0f);
     s->team = rand() % 2;
+    s->steering = &boid_steering;
     
     SimpleRenderable *r = m->add_component<SimpleRenderable>(e);
     r->mesh = ship_mesh;
@@ -675,33 +1261,6 @@ static void add_asteroid(EntityManager *m, vec3 pos) {
 
 
 
-static Entity *closest_to_mouse(EntityManager *manager) {
-    BodySystem *sys = manager->get_system<BodySystem>();
-
-    Body *best = nullptr;
-    float best_dist = 100000.0f;
-
-    sys->quad_tree.query(cursor_pos.x - 50, cursor_pos.y - 50,
-                         cursor_pos.x + 50, cursor_pos.y + 50,
-                         [&](QuadTree::Object *obj) mutable
-    {
-        Body *b = static_cast<Body *>(obj);
-        if (!best) {
-            best = b;
-        } else {
-            vec3 d = b->pos - cursor_pos;
-            float dist = glm::length(d);
-            if (dist < best_dist) {
-                best = b;
-                best_dist = dist;
-            }
-        }
-    });
-
-    if (!best)
-        return nullptr;
-    return best->entity;
-}
 
 
 
@@ -716,12 +1275,32 @@ static Entity *closest_to_mouse(EntityManager *manager) {
 SDL_DisplayMode mode;
 mat4 projection_matrix, view_matrix;
 
+// points on the near and far plane under the screen position
+static void screen_to_segment(int x, int y, vec3 &p0, vec3 &p1) {
+    p0 = glm::unProject(vec3(x, mode.h - y - 1, 0), view_matrix, projection_matrix, vec4(0, 0, mode.w, mode.h));
+    p1 = glm::unProject(vec3(x, mode.h - y - 1, 1), view_matrix, projection_matrix, vec4(0, 0, mode.w, mode.h));
+}
+
 static vec3 screen_to_world(int x, int y) {
-    vec3 p0 = glm::unProject(vec3(x, mode.h - y - 1, 0), view_matrix, projection_matrix, vec4(0, 0, mode.w, mode.h));
-    vec3 p1 = glm::unProject(vec3(x, mode.h - y - 1, 1), view_matrix, projection_matrix, vec4(0, 0, mode.w, mode.h));
+    vec3 p0, p1;
+    screen_to_segment(x, y, p0, p1);
     return Plane::XY().ray_intersect(p0, p1);
 }
 
+// the nearest body under the mouse, at any height
+static Entity *closest_to_mouse(EntityManager *manager, int x, int y) {
+    const SpatialSnapshot<Body> &snapshot = manager->get_system<BodySystem>()->snapshot();
+
+    vec3 p0, p1;
+    screen_to_segment(x, y, p0, p1);
+
+    float t;
+    const SpatialSnapshot<Body>::Entry *hit = snapshot.segment_cast(p0, p1, t);
+    if (!hit)
+        return nullptr;
+    return hit->obj->entity;
+}
+
 
 
 int main(int argc, char *argv[]) {
@@ -841,10 +1420,22 @@ int main(int argc, char *argv[]) {
 
     //SDL_SetRelativeMouseMode(SDL_TRUE);
 
-    BodySystem body_system;
-    ShipSystem ship_system;
+    // The simulation runs at a fixed rate whatever the frame rate is.
+    // After a hitch it catches up with at most max_sim_steps steps and
+    // drops the rest, so it slows down rather than taking huge steps.
+    const float sim_rate = 30.0f;
+    const float sim_step = 1.0f / sim_rate;
+    const int max_sim_steps = 5;
+
+    ThreadPool thread_pool;
+    BodySystem body_system(sim_rate);
+    ShipSystem ship_system(&thread_pool, sim_rate);
+    body_system.rvo_neighbors_max_age = ship_system.neighbor_schedule.num_buckets();
     SimpleRenderableSystem simple_renderable_system;
     EntityManager entity_manager;
+    // RVO steps and ship updates never overlap, so both pools can use
+    // every core
+    body_system.rvo_sim.setNumThreads(thread_pool.num_threads());
     entity_manager.add_system(&body_system);
     entity_manager.add_system(&ship_system);
     entity_manager.add_system(&simple_renderable_system);
@@ -866,7 +1457,9 @@ int main(int argc, char *argv[]) {
     vec3 light_dir = glm::normalize(vec3(1, 0, 3));
 
     const Uint8 *keys = SDL_GetKeyboardState(0);
-    Uint32 prevticks = SDL_GetTicks();
+    const double counter_frequency = (double)SDL_GetPerformanceFrequency();
+    Uint64 prevcounter = SDL_GetPerformanceCounter();
+    double sim_time = 0; // not yet simulated
     bool running = true;
     bool rotating = false;
 
@@ -891,10 +1484,9 @@ int main(int argc, char *argv[]) {
         // Updating:
         //////////////////////////////////////////////////////////////////////////////////////////////////
 
-        Uint32 ticks = SDL_GetTicks();
-        Uint32 tickdiff = ticks - prevticks;
-        prevticks = ticks;
-        float dt = (float)tickdiff / 1000.0f;
+        Uint64 counter = SDL_GetPerformanceCounter();
+        sim_time += (double)(counter - prevcounter) / counter_frequency;
+        prevcounter = counter;
 
         int mx = 0, my = 0;
         SDL_GetMouseState(&mx, &my);
@@ -926,22 +1518,33 @@ int main(int argc, char *argv[]) {
         if (!rotating)
             cursor_pos = screen_to_world(mx, my);
         
+        //light_dir = glm::normalize(glm::angleAxis(dt*10.0f, vec3(0, 0, 1)) * light_dir);
+
+        ship_system.lod_center = camera_pos;
+
+        int sim_steps = 0;
+        while (sim_time >= sim_step && sim_steps < max_sim_steps) {
+            ship_system.update(&entity_manager);
+            body_system.update();
+            entity_manager.update();
+            sim_time -= sim_step;
+            ++sim_steps;
+        }
+        if (sim_time >= sim_step)
+            sim_time = 0;
+
+        body_system.interpolate((float)(sim_time / sim_step));
+
         if (selected_entity) {
             if (selected_entity->dying()) {
                 selected_entity = nullptr;
             }  else {
                 Body *b = selected_entity->get_component<Body>();
-                camera_focus = b->pos;
+                camera_focus = b->render_pos;
             }
         }
 
-        Entity *hovered_entity = closest_to_mouse(&entity_manager);
-
-        //light_dir = glm::normalize(glm::angleAxis(dt*10.0f, vec3(0, 0, 1)) * light_dir);
-
-        ship_system.update(&entity_manager, dt);
-        body_system.update(dt);
-        entity_manager.update();
+        Entity *hovered_entity = closest_to_mouse(&entity_manager, mx, my);
 
 
         //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -961,19 +1564,22 @@ int main(int argc, char *argv[]) {
 
         skybox.render(view_matrix, perspective_matrix);
 
-        simple_renderable_system.render(&renderqueue, view_matrix, projection_matrix);
+        simple_renderable_system.render(&renderqueue, view_matrix, projection_matrix,
+                                        body_system.snapshot(), body_system.max_step);
         renderqueue.flush();
 
         {
+            ship_system.gather_debug_lines(line_vertexes);
+
             if (orthogonal_projection) {
-                body_system.quad_tree.gather_outlines([&](float x, float y) mutable {
+                body_system.gather_outlines([&](float x, float y) mutable {
                     line_vertexes.push_back(LineVertex(vec3(x, y, 0), vec4(1, 1, 1, 0.1f)));
                 });
                 for (auto b : body_system) {
-                    vec3 pos = b->pos;
+                    vec3 pos = b->render_pos;
                     pos.z = 0;
                     line_vertexes.push_back(LineVertex(pos, vec4(1, 1, 1, 0.2f)));
-                    line_vertexes.push_back(LineVertex(b->pos, vec4(1, 1, 1, 0.2f)));
+                    line_vertexes.push_back(LineVertex(b->render_pos, vec4(1, 1, 1, 0.2f)));
                 }
                 if (line_vertexes.size() > max_line_vertexes)
                     line_vertexes.resize(max_line_vertexes);
@@ -982,10 +1588,10 @@ int main(int argc, char *argv[]) {
             if (hovered_entity) {
                 Body *b = hovered_entity->get_component<Body>();
 
-                vec3 p0 = b->pos - camera_right*b->radius;
-                vec3 p1 = b->pos - camera_up*b->radius;
-                vec3 p2 = b->pos + camera_right*b->radius;
-                vec3 p3 = b->pos + camera_up*b->radius;
+                vec3 p0 = b->render_pos - camera_right*b->radius;
+                vec3 p1 = b->render_pos - camera_up*b->radius;
+                vec3 p2 = b->render_pos + camera_right*b->radius;
+                vec3 p3 = b->render_pos + camera_up*b->radius;
 
                 vec4 c(1, 1, 1, 0.5f);
 
@@ -1048,6 +1654,11 @@ int main(int argc, char *argv[]) {
             case SDL_KEYDOWN:
                 if (event.key.keysym.sym == SDLK_f)
                     add_asteroid(&entity_manager, cursor_pos);
+                if (event.key.keysym.sym == SDLK_g && selected_entity) {
+                    Ship *s = selected_entity->get_component<Ship>();
+                    if (s)
+                        ship_system.order_move(&entity_manager, s, cursor_pos);
+                }
                 break;
             case SDL_KEYUP:
                 if (event.key.keysym.sym == SDLK_ESCAPE)
@@ -0,0 +1,100 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cfloat>
+#include "util/mymath.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+// The six planes of a view frustum, with normals pointing inwards.
+// Planes are stored as structure of arrays, padded to eight with planes
+// that accept everything, so a sphere is tested against all of them with
+// two SSE operations.
+class Frustum {
+public:
+    enum Result {
+        OUTSIDE,
+        INTERSECTS,
+        INSIDE
+    };
+
+    // extract the planes from a projection * view matrix
+    explicit Frustum(const mat4 &m) {
+        vec4 row[4];
+        for (int i = 0; i < 4; ++i)
+            row[i] = vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+        set_plane(0, row[3] + row[0]); // left
+        set_plane(1, row[3] - row[0]); // right
+        set_plane(2, row[3] + row[1]); // bottom
+        set_plane(3, row[3] - row[1]); // top
+        set_plane(4, row[3] + row[2]); // near
+        set_plane(5, row[3] - row[2]); // far
+        for (int i = 6; i < 8; ++i)
+            set_plane(i, vec4(0, 0, 0, FLT_MAX));
+    }
+
+    // a frustum with every plane moved outwards by margin
+    Frustum expanded(float margin) const {
+        Frustum f(*this);
+        for (int i = 0; i < 6; ++i)
+            f.d[i] += margin;
+        return f;
+    }
+
+    bool intersects_sphere(vec3 center, float radius) const {
+#ifdef FRUSTUM_SSE
+        const __m128 cx = _mm_set1_ps(center.x);
+        const __m128 cy = _mm_set1_ps(center.y);
+        const __m128 cz = _mm_set1_ps(center.z);
+        const __m128 r = _mm_set1_ps(-radius);
+        int outside = 0;
+        for (int i = 0; i < 8; i += 4) {
+            __m128 dist = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&nx[i]), cx), _mm_mul_ps(_mm_loadu_ps(&ny[i]), cy)),
+                _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&nz[i]), cz), _mm_loadu_ps(&d[i])));
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(dist, r));
+        }
+        return outside == 0;
+#else
+        for (int i = 0; i < 6; ++i) {
+            if (nx[i] * center.x + ny[i] * center.y + nz[i] * center.z + d[i] < -radius)
+                return false;
+        }
+        return true;
+#endif
+    }
+
+    Result classify_box(vec3 min, vec3 max) const {
+        Result result = INSIDE;
+        for (int i = 0; i < 6; ++i) {
+            // the corners furthest along and against the plane normal
+            vec3 p(nx[i] >= 0 ? max.x : min.x, ny[i] >= 0 ? max.y : min.y, nz[i] >= 0 ? max.z : min.z);
+            vec3 n(nx[i] >= 0 ? min.x : max.x, ny[i] >= 0 ? min.y : max.y, nz[i] >= 0 ? min.z : max.z);
+            if (nx[i] * p.x + ny[i] * p.y + nz[i] * p.z + d[i] < 0)
+                return OUTSIDE;
+            if (nx[i] * n.x + ny[i] * n.y + nz[i] * n.z + d[i] < 0)
+                result = INTERSECTS;
+        }
+        return result;
+    }
+
+private:
+    void set_plane(int i, vec4 p) {
+        float len = glm::length(vec3(p));
+        if (len > 0)
+            p /= len;
+        nx[i] = p.x;
+        ny[i] = p.y;
+        nz[i] = p.z;
+        d[i] = p.w;
+    }
+
+    float nx[8], ny[8], nz[8], d[8];
+};
+
+
+#endif
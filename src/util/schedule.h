@@ -0,0 +1,69 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+// Update rate of one system in a simulation that ticks at a fixed rate.
+//
+// A system slower than the simulation splits its objects into round-robin
+// buckets and updates one bucket per tick, so the work is spread evenly
+// over the ticks instead of coming all at once. A system faster than the
+// simulation updates everything in several substeps per tick.
+//
+// Objects keep the tick they were last updated at, and dt_since() gives
+// the time that has passed since, which is also right for objects that
+// were just created.
+class UpdateSchedule {
+public:
+    UpdateSchedule(float tick_rate, float rate) :
+        tick_dt(1.0f / tick_rate),
+        buckets(std::max(1, (int)floorf(tick_rate / rate + 0.5f))),
+        steps(std::max(1, (int)floorf(rate / tick_rate + 0.5f))),
+        ticks(0),
+        next_bucket(0)
+    {
+        assert(tick_rate > 0 && rate > 0);
+    }
+
+    // ticks it takes to update every object once
+    int num_buckets() const { return buckets; }
+
+    // updates of every object per tick
+    int substeps() const { return steps; }
+    float substep_dt() const { return tick_dt / steps; }
+
+    // ticks since the schedule was created
+    unsigned int tick() const { return ticks; }
+    void advance() { ++ticks; }
+
+    // bucket for a new object, so buckets fill up evenly
+    int assign_bucket() {
+        int b = next_bucket;
+        next_bucket = (next_bucket + 1) % buckets;
+        return b;
+    }
+
+    // whether objects in the bucket update this tick
+    bool due(int bucket) const { return (int)(ticks % buckets) == bucket; }
+
+    // Time an object updated this tick has to cover, given the tick it was
+    // last updated at. An update covers the ticks since the last one,
+    // including the current tick.
+    float dt_since(unsigned int last) const { return (float)(ticks - last) * tick_dt; }
+
+    // last update tick for objects created before the current tick, so
+    // that their first update covers every tick they have existed for
+    unsigned int initial_tick() const { return ticks - 1; }
+
+private:
+    float tick_dt;
+    int buckets;
+    int steps;
+    unsigned int ticks;
+    int next_bucket;
+};
+
+
+#endif
@@ -0,0 +1,86 @@
+#include "util/threadpool.h"
+#include <cassert>
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(int num_workers) :
+    quit(false), generation(0), busy_workers(0),
+    func(nullptr), count(0), chunk_size(1), num_chunks(0), next_chunk(0)
+{
+    if (num_workers < 0)
+        num_workers = std::max(0, (int)std::thread::hardware_concurrency() - 1);
+    for (int i = 0; i < num_workers; ++i)
+        workers.push_back(std::thread(&ThreadPool::worker_main, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    start_cond.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+void ThreadPool::parallel_for(int count, int chunk_size, const std::function<void(int, int, int)> &func) {
+    assert(chunk_size > 0);
+    if (count <= 0)
+        return;
+
+    int num_chunks = (count + chunk_size - 1) / chunk_size;
+    if (workers.empty() || num_chunks == 1) {
+        for (int c = 0; c < num_chunks; ++c)
+            func(c, c * chunk_size, std::min(count, (c + 1) * chunk_size));
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        assert(busy_workers == 0);
+        this->func = &func;
+        this->count = count;
+        this->chunk_size = chunk_size;
+        this->num_chunks = num_chunks;
+        next_chunk.store(0);
+        busy_workers = (int)workers.size();
+        ++generation;
+    }
+    start_cond.notify_all();
+
+    run_chunks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (busy_workers > 0)
+        done_cond.wait(lock);
+    this->func = nullptr;
+}
+
+void ThreadPool::run_chunks() {
+    for (;;) {
+        int c = next_chunk.fetch_add(1);
+        if (c >= num_chunks)
+            return;
+        (*func)(c, c * chunk_size, std::min(count, (c + 1) * chunk_size));
+    }
+}
+
+void ThreadPool::worker_main() {
+    unsigned int seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!quit && generation == seen)
+                start_cond.wait(lock);
+            if (quit)
+                return;
+            seen = generation;
+        }
+
+        run_chunks();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy_workers == 0)
+            done_cond.notify_one();
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// Fixed set of worker threads for data parallel loops. parallel_for()
+// splits a range into chunks of a fixed size and hands them out to the
+// workers and the calling thread; which thread runs a chunk varies, but
+// the chunks themselves don't depend on the number of threads, so work
+// that only writes per-chunk state gives the same results either way.
+class ThreadPool {
+public:
+    // num_workers < 0 picks one less than the number of hardware threads,
+    // since the calling thread works too
+    explicit ThreadPool(int num_workers = -1);
+    ~ThreadPool();
+
+    // threads taking part in parallel_for(), including the caller
+    int num_threads() const { return (int)workers.size() + 1; }
+
+    // call func(chunk, begin, end) for every chunk of [0, count) and wait
+    // until all chunks are done; must not be called from inside func
+    void parallel_for(int count, int chunk_size, const std::function<void(int, int, int)> &func);
+
+private:
+    // non-copyable
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+
+    void worker_main();
+    void run_chunks();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_cond, done_cond;
+    bool quit;
+    unsigned int generation;  // bumped for every parallel_for()
+    int busy_workers;
+
+    // the current loop
+    const std::function<void(int, int, int)> *func;
+    int count, chunk_size, num_chunks;
+    std::atomic<int> next_chunk;
+};
+
+
+#endif
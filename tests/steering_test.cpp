@@ -0,0 +1,236 @@
+// Checks that the fused steering pipeline computes exactly what the
+// separate separation, zseparation, alignment and cohesion loops of Ship
+// did before they were folded into calc_offsets and the behaviors.
+// `make test` runs it on the scalar, SSE and (where the CPU has it) AVX
+// kernels.
+
+#define BOOST_TEST_MODULE steering
+#include <boost/test/unit_test.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "game/steering.h"
+
+namespace {
+
+struct Neighbor {
+    vec3 pos, vel;
+    bool closest, friend_;
+};
+
+// the old Ship members, over neighbor lists instead of entities
+struct OldShip {
+    vec3 pos, vel;
+    float maxspeed, maxforce;
+    std::vector<Neighbor> closest, friends;
+
+    vec3 steer(vec3 dir) {
+        float len = glm::length(dir);
+        if (len < 0.000001f)
+            return vec3(0, 0, 0);
+        dir *= maxspeed / len;
+        return limit(dir - vel, maxforce);
+    }
+
+    vec3 seek(vec3 target) {
+        return steer(target - pos);
+    }
+
+    vec3 separation() {
+        float sep = 20;
+        vec3 sum(0, 0, 0);
+        int count = 0;
+        for (size_t i = 0; i < closest.size(); ++i) {
+            vec3 d = pos - closest[i].pos;
+            float len = glm::length(d);
+            if (len > sep || len <= 0.00001f) continue;
+            d = glm::normalize(d);
+            d /= len;
+            sum += d;
+            ++count;
+        }
+        if (count == 0)
+            return vec3(0, 0, 0);
+        sum /= (float)count;
+        return steer(sum);
+    }
+
+    vec3 zseparation() {
+        float sep = 20;
+        vec3 sum(0, 0, 0);
+        int count = 0;
+        for (size_t i = 0; i < closest.size(); ++i) {
+            vec3 d = pos - closest[i].pos;
+            float len = glm::length(d);
+            if (len > sep || len <= 0.00001f) continue;
+            float dz = d.z;
+            if (dz == 0)
+                dz = glm::dot(glm::normalize(vel), glm::normalize(closest[i].vel));
+            dz /= fabsf(dz);
+            dz /= len;
+            sum += vec3(0, 0, dz);
+            ++count;
+        }
+        if (count == 0)
+            return vec3(0, 0, 0);
+        sum /= (float)count;
+        return steer(sum);
+    }
+
+    vec3 alignment() {
+        float neighbordist = 50;
+        vec3 sum(0, 0, 0);
+        int count = 0;
+        for (size_t i = 0; i < friends.size(); ++i) {
+            vec3 d = pos - friends[i].pos;
+            float dist = glm::length(d);
+            if (dist > neighbordist) continue;
+            sum += friends[i].vel;
+            ++count;
+        }
+        if (count == 0)
+            return vec3(0, 0, 0);
+        sum /= (float)count;
+        return steer(sum);
+    }
+
+    vec3 cohesion() {
+        float neighbordist = 50;
+        vec3 sum(0, 0, 0);
+        int count = 0;
+        for (size_t i = 0; i < friends.size(); ++i) {
+            vec3 d = pos - friends[i].pos;
+            float len = glm::length(d);
+            if (len > neighbordist) continue;
+            sum += friends[i].pos;
+            ++count;
+        }
+        if (count == 0)
+            return vec3(0, 0, 0);
+        sum /= (float)count;
+        return seek(sum);
+    }
+};
+
+float random(float lo, float hi) {
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+vec3 random_vec(float lo, float hi) {
+    return vec3(random(lo, hi), random(lo, hi), random(lo, hi));
+}
+
+// a velocity that is never zero, so that zseparation can normalize it
+vec3 random_vel() {
+    vec3 v = random_vec(-10, 10);
+    v.x = v.x < 0 ? v.x - 0.5f : v.x + 0.5f;
+    return v;
+}
+
+bool same_bits(vec3 a, vec3 b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Random neighborhoods around a ship, some with neighbors on top of the
+// ship or of each other and some flattened into the ship's plane.
+void random_neighborhood(int count, OldShip &old, SteeringContext &ctx, SteeringNeighbors &n) {
+    bool flat = rand() % 3 == 0;
+
+    old.pos = random_vec(-100, 100);
+    old.vel = random_vel();
+    old.maxspeed = random(5, 20);
+    old.maxforce = random(0.1f, 2);
+    old.closest.clear();
+    old.friends.clear();
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.pos = old.pos;
+    ctx.vel = old.vel;
+    ctx.maxspeed = old.maxspeed;
+    ctx.maxforce = old.maxforce;
+    ctx.radius = 1;
+
+    n.clear();
+    for (int i = 0; i < count; ++i) {
+        Neighbor nb;
+        switch (rand() % 6) {
+        case 0: nb.pos = old.pos; break;
+        case 1: nb.pos = i > 0 ? n.pos(i - 1) : old.pos; break;
+        default: nb.pos = old.pos + random_vec(-40, 40); break;
+        }
+        if (flat || rand() % 4 == 0)
+            nb.pos.z = old.pos.z;
+        nb.vel = random_vel();
+        nb.closest = rand() % 2 == 0;
+        nb.friend_ = rand() % 2 == 0;
+
+        if (nb.closest)
+            old.closest.push_back(nb);
+        if (nb.friend_)
+            old.friends.push_back(nb);
+
+        unsigned char flags = 0;
+        if (nb.closest) flags |= SteeringNeighbors::CLOSEST;
+        if (nb.friend_) flags |= SteeringNeighbors::FRIEND;
+        n.add(nb.pos, nb.vel, 1, flags);
+    }
+}
+
+} // namespace
+
+
+BOOST_AUTO_TEST_CASE(pipeline_matches_old_loops)
+{
+    SteeringPipeline<Separation, Alignment, Cohesion> flocking(
+        Separation(1.5f, 20.0f), Alignment(1.0f, 50.0f), Cohesion(1.0f, 50.0f));
+    SteeringPipeline<ZSeparation> zseparation(ZSeparation(1.0f, 20.0f));
+
+    srand(1);
+    OldShip old;
+    SteeringContext ctx;
+    SteeringNeighbors n;
+
+    for (int iter = 0; iter < 100000; ++iter) {
+        random_neighborhood(rand() % (SteeringNeighbors::CAPACITY + 1), old, ctx, n);
+
+        vec3 expected(0, 0, 0);
+        expected += old.separation() * 1.5f;
+        expected += old.alignment() * 1.0f;
+        expected += old.cohesion() * 1.0f;
+        vec3 got = flocking.evaluate(ctx, n);
+        BOOST_REQUIRE_MESSAGE(same_bits(expected, got), "flocking differs in neighborhood " << iter);
+
+        expected = vec3(0, 0, 0);
+        expected += old.zseparation() * 1.0f;
+        got = zseparation.evaluate(ctx, n);
+        BOOST_REQUIRE_MESSAGE(same_bits(expected, got), "zseparation differs in neighborhood " << iter);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(offsets_of_coincident_ships)
+{
+    SteeringNeighbors n;
+    NeighborOffsets o;
+    vec3 pos(1, 2, 3);
+    n.add(pos, vec3(1, 0, 0), 1, SteeringNeighbors::CLOSEST | SteeringNeighbors::FRIEND);
+    n.add(pos + vec3(3, 4, 0), vec3(1, 0, 0), 1, SteeringNeighbors::CLOSEST);
+    calc_offsets(pos, n, o);
+
+    BOOST_CHECK_EQUAL(o.len[0], 0.0f);
+    BOOST_CHECK_EQUAL(o.dz[1], 0.0f);
+    BOOST_CHECK_EQUAL(o.len[1], 5.0f);
+
+    // the coincident ship is skipped by separation but still counts for
+    // alignment and cohesion
+    SteeringContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.pos = pos;
+    ctx.vel = vec3(0, 1, 0);
+    ctx.maxspeed = 10;
+    ctx.maxforce = 100;
+    SteeringPipeline<Separation> separation(Separation(1.0f, 20.0f));
+    vec3 v = separation.evaluate(ctx, n);
+    BOOST_CHECK(v.x == v.x && v.y == v.y && v.z == v.z);
+    BOOST_CHECK(v.x < 0);
+}